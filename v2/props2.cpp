@@ -7,8 +7,21 @@
 #  include <unistd.h>           // read()
 #endif
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
+#if !defined(ARDUPILOT_BUILD)
+#  include <pthread.h>
+#  include <atomic>
+#  include <mutex>
+#  include <thread>
+#endif
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <string>
 using std::vector;
@@ -18,617 +31,3569 @@ using std::string;
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/prettywriter.h"
 
-#include "strutils.h"
 #include "props2.h"
+#include "props2_binary.h"
+#include "props2_log.h"
+#include "props2_packed.h"
+#include "props2_stream.h"
 
 static void pretty_print_tree(Value *v) {
     StringBuffer buffer;
     PrettyWriter<StringBuffer> writer(buffer);
-    v->Accept(writer);
+    PackedExpander< PrettyWriter<StringBuffer> > expander(writer);
+    v->Accept(expander);
     //const char* output = buffer.GetString();
     printf("%s\n", buffer.GetString());
 }
 
-static bool is_integer(const string val) {
-    for ( int i = 0; i < val.length(); i++ ) {
-        if ( val[i] < '0' or val[i] > '9' ) {
+// parse a path token as an array index, token is not null terminated
+static bool parse_index(const char *token, int len, int *index) {
+    int result = 0;
+    for ( int i = 0; i < len; i++ ) {
+        if ( token[i] < '0' or token[i] > '9' ) {
             return false;
         }
+        if ( result > (INT_MAX - 9) / 10 ) {
+            return false;       // too big to be a sensible index
+        }
+        result = result * 10 + (token[i] - '0');
     }
+    *index = result;
     return true;
 }
 
-static bool extend_array(Value *node, int size) {
-    if ( !node->IsArray() ) {
-        node->SetArray();
-    }
-    for ( int i = node->Size(); i <= size; i++ ) {
-        printf("    extending: %d\n", i);
-        Value newobj(kObjectType);
-        node->PushBack(newobj, doc.GetAllocator());
+// Concurrency mode: threads may use a tree at the same time through
+// stable handles.  There is a reader/writer lock for the whole tree
+// and one for each node (in its path record):
+//
+//   PROPS2_LOCK_READ       tree shared, node shared: read the node's
+//                          members (and arrays under them)
+//   PROPS2_LOCK_WRITE      tree shared, node exclusive: store into the
+//                          node's existing members in place
+//   PROPS2_LOCK_STRUCTURE  tree exclusive: everything else (adding
+//                          members, resizing, allocating strings,
+//                          loading, walking whole subtrees)
+//
+// so threads reading and writing disjoint nodes run in parallel.  A
+// setter starts with the write lock and escalates if it turns out the
+// change is structural.  Nodes without a record (raw nodes) always
+// take the structure lock.  Not available on ArduPilot builds.
+#if !defined(ARDUPILOT_BUILD)
+class RWLock {
+public:
+    RWLock() { pthread_rwlock_init(&lock, nullptr); }
+    ~RWLock() { pthread_rwlock_destroy(&lock); }
+    void lock_shared() { pthread_rwlock_rdlock(&lock); }
+    void lock_exclusive() { pthread_rwlock_wrlock(&lock); }
+    void unlock() { pthread_rwlock_unlock(&lock); }
+
+private:
+    pthread_rwlock_t lock;
+};
+
+// tree whose structure lock this thread holds (nested calls don't relock)
+static thread_local PropertyTree *holds_structure = nullptr;
+
+// Change generations are stamped from any thread in concurrency mode
+// (only needs to be atomic then, plain loads and stores otherwise.)
+typedef std::atomic<uint64_t> ChangeGen;
+
+static inline uint64_t gen_load(const ChangeGen &g) {
+    return g.load(std::memory_order_relaxed);
+}
+
+static inline uint64_t gen_next(ChangeGen &g, bool concurrent) {
+    if ( concurrent ) {
+        return g.fetch_add(1, std::memory_order_relaxed) + 1;
     }
-    return true;
+    uint64_t gen = g.load(std::memory_order_relaxed) + 1;
+    g.store(gen, std::memory_order_relaxed);
+    return gen;
 }
 
-PropertyNode::PropertyNode() {
+static inline void gen_store(ChangeGen &g, uint64_t gen) {
+    g.store(gen, std::memory_order_relaxed);
 }
 
-static Value *find_node_from_path(Value *start_node, string path, bool create) {
-    Value *node = start_node;
-    printf("PropertyNode(%s)\n", path.c_str());
-    if ( !node->IsObject() ) {
-        node->SetObject();
-        if ( !node->IsObject() ) {
-            printf("  still not object after setting to object.\n");
-        }              
-    }
-    vector<string> tokens = split(path, "/");
-    for ( int i = 0; i < tokens.size(); i++ ) {
-        if ( tokens[i].length() == 0 ) {
-            continue;
-        }
-        // printf("  token: %s\n", tokens[i].c_str());
-        if ( is_integer(tokens[i]) ) {
-            // array reference
-            int index = std::stoi(tokens[i].c_str());
-            extend_array(node, index+1);
-            // printf("Array size: %d\n", node->Size());
-            node = &(*node)[index];
-            //PropertyNode(node).pretty_print();
-        } else {
-            if ( node->HasMember(tokens[i].c_str()) ) {
-                // printf("    has %s\n", tokens[i].c_str());
-                node = &(*node)[tokens[i].c_str()];
-            } else if ( create ) {
-                printf("    creating %s\n", tokens[i].c_str());
-                Value key;
-                key.SetString(tokens[i].c_str(), tokens[i].length(), doc.GetAllocator());
-                Value newobj(kObjectType);
-                node->AddMember(key, newobj, doc.GetAllocator());
-                node = &(*node)[tokens[i].c_str()];
-                // printf("  new node: %p\n", node);
-            } else {
-                return nullptr;
-            }
-        }
+// raise g to gen (a slower thread mustn't lower it)
+static inline void gen_raise(ChangeGen &g, uint64_t gen) {
+    uint64_t cur = g.load(std::memory_order_relaxed);
+    while ( cur < gen and !g.compare_exchange_weak(cur, gen, std::memory_order_relaxed) ) {
     }
-    if ( node->IsArray() ) {
-        // when node is an array and no index specified, default to /0
-        if ( node->Size() > 0 ) {
-            node = &(*node)[0];
-        }
+}
+
+// statistics counters, bumped from any thread in concurrency mode
+typedef std::atomic<unsigned long> Counter;
+
+static inline void count_add(Counter &c) {
+    c.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline unsigned long count_load(const Counter &c) {
+    return c.load(std::memory_order_relaxed);
+}
+#else
+typedef uint64_t ChangeGen;
+
+static inline uint64_t gen_load(const ChangeGen &g) { return g; }
+static inline uint64_t gen_next(ChangeGen &g, bool) { return ++g; }
+static inline void gen_store(ChangeGen &g, uint64_t gen) { g = gen; }
+static inline void gen_raise(ChangeGen &g, uint64_t gen) { g = gen; }
+
+typedef unsigned long Counter;
+
+static inline void count_add(Counter &c) { c++; }
+static inline unsigned long count_load(const Counter &c) { return c; }
+#endif
+
+// tree->structure_gen is bumped whenever tree storage may have been
+// relocated or discarded (members or array elements added or removed,
+// containers replaced)
+static inline void structure_changed(PropertyTree *tree) {
+    tree->structure_gen++;
+}
+
+// replacing a container value with a scalar discards its children
+static inline void check_replace(PropertyTree *tree, Value *v) {
+    if ( v->IsObject() or v->IsArray() ) {
+        structure_changed(tree);
     }
-    // printf(" found/create node->%d\n", (int)node);
-    return node;
 }
 
-PropertyNode::PropertyNode(string abs_path, bool create) {
-    // printf("PropertyNode(%s) %d\n", abs_path.c_str(), (int)&doc);
-    if ( abs_path[0] != '/' ) {
-        printf("  not an absolute path\n");
-        return;
+// Wide objects (such as flat parameter tables) get a side index of
+// member name -> member position so lookups don't scan the member
+// array.  The index is built lazily the first time an object of at
+// least member_index_threshold members is searched, and is keyed on the
+// object's member storage so it stays valid when the object value
+// itself is moved by its parent growing.  Small objects carry no index,
+// and neither do snapshot copies (they belong to no tree.)
+static const SizeType member_index_threshold = 32;
+
+struct MemberIndex {
+    SizeType count = 0;         // number of members covered
+    vector<int> slots;          // open addressed, member position or -1
+};
+
+typedef std::unordered_map<const Value::Member *, MemberIndex> MemberIndexMap;
+
+// capacity of the reusable string leaf buffers (see setString()), keyed
+// on the buffer
+typedef std::unordered_map<const char *, SizeType> StringBufferMap;
+
+struct PropertyRecord;
+struct Subscription;
+struct SnapshotChannel;
+struct LoadTrace;
+
+// Stable handles: nodes and bound leaves created from a path keep a
+// pointer to a record for that path.  Records form a trie mirroring the
+// paths that have been resolved (they live as long as the tree) and
+// cache the resolved value along with the tree->structure_gen it was
+// resolved at.  Any structural change bumps the generation and handles
+// lazily re-resolve through their record, so a cached node or leaf
+// stays valid when siblings are added, arrays grow, etc.  Nodes made
+// directly from a Value pointer (or with stable handles disabled) are
+// raw pointers into the tree as before.
+struct PropertyRecord {
+    PropertyRecord *parent = nullptr;
+    string name;                // member name
+    int index = -1;             // or array index
+    Value *val = nullptr;
+    uint32_t gen = 0;
+    ChangeGen changed{0};       // change_gen of last change at or below
+    ChangeGen touched{0};       // change_gen this value was last set
+    vector<PropertyRecord *> children;
+    vector<PropertyRecord *> slots; // children hash index (wide nodes)
+#if !defined(ARDUPILOT_BUILD)
+    RWLock lock;                // node lock (concurrency mode)
+    SnapshotChannel *channel = nullptr; // snapshots published of this path
+#endif
+};
+
+// everything a PropertyTree owns besides its document
+struct PropertyTreeState {
+    PropertyRecord root;        // path records
+    MemberIndexMap member_indices;
+    StringBufferMap string_buffers;
+    ChangeGen change_gen{0};
+    vector<Subscription *> subscriptions;
+    int next_subscription_id = 1;
+    bool dispatching = false;
+    bool stable_handles = true; // nodes from paths get path records
+    int packed_array_min = 16;  // numeric arrays at least this long are
+                                // packed on load (0 = never)
+    LoadTrace *load_trace = nullptr; // files read by the current load
+    char *arena = nullptr;      // arena trees: the preallocated block
+    size_t arena_size = 0;
+    MemoryPoolAllocator<> *arena_allocator = nullptr;
+    bool frozen = false;        // freezeAllocations() called
+    Counter refused{0};         // allocations refused since
+#if !defined(ARDUPILOT_BUILD)
+    RWLock lock;                // tree lock (concurrency mode)
+    std::mutex resolve_mutex;   // records re-resolved under a shared lock
+    std::mutex index_mutex;     // member indices built under a shared lock
+    std::mutex channel_mutex;   // channels (never removed)
+    vector<SnapshotChannel *> channels;
+    vector<MemoryPoolAllocator<> *> include_allocators;
+#endif
+};
+
+// FNV-1a
+static uint32_t hash_name(const char *name, int len) {
+    uint32_t h = 2166136261u;
+    for ( int i = 0; i < len; i++ ) {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
     }
-    val = find_node_from_path(&doc, abs_path, create);
-    // pretty_print();
+    return h;
 }
 
-PropertyNode::PropertyNode(Value *v) {
-    val = v;
+static void index_insert(MemberIndex *index, const Value::Member *members,
+                         SizeType pos)
+{
+    const Value &key = members[pos].name;
+    uint32_t mask = index->slots.size() - 1;
+    uint32_t h = hash_name(key.GetString(), key.GetStringLength()) & mask;
+    while ( index->slots[h] >= 0 ) {
+        h = (h + 1) & mask;
+    }
+    index->slots[h] = pos;
+    index->count++;
 }
 
-bool PropertyNode::hasChild( const char *name ) {
-    if ( val->IsObject() ) {
-        if ( val->HasMember(name) ) {
-            return true;
-        }
+static void index_build(MemberIndex *index, Value *node) {
+    SizeType count = node->MemberCount();
+    size_t size = 2 * member_index_threshold;
+    while ( size < count * 2 ) {
+        size *= 2;
+    }
+    index->slots.assign(size, -1);
+    index->count = 0;
+    const Value::Member *members = &*node->MemberBegin();
+    for ( SizeType i = 0; i < count; i++ ) {
+        index_insert(index, members, i);
     }
-    return false;
 }
 
-PropertyNode PropertyNode::getChild( const char *name, bool create ) {
-    if ( val->IsObject() ) {
-        Value *child = find_node_from_path(val, name, create);
-        return PropertyNode(child);
+// Frozen trees: every code path that would allocate from the tree's
+// allocator asks first and fails if the tree is frozen.  The decision
+// depends only on the operation (never on how full the arena is), so a
+// frozen tree behaves the same on every run.
+static bool refuse_allocation(PropertyTree *tree, const char *what) {
+    if ( !tree->state->frozen ) {
+        return false;
     }
-    printf("%s not an object...\n", name);
-    return PropertyNode();
+    count_add(tree->state->refused);
+    PROPS2_ERROR("allocations frozen, refused: %s\n", what);
+    return true;
 }
 
-bool PropertyNode::isNull() {
-    return val == nullptr;
+// return the (valid) member index for an object or nullptr if the
+// object is too small to bother (or outside any tree)
+static MemberIndex *get_member_index(PropertyTree *tree, Value *node) {
+    if ( tree == nullptr or node->MemberCount() < member_index_threshold ) {
+        return nullptr;
+    }
+#if !defined(ARDUPILOT_BUILD)
+    std::unique_lock<std::mutex> guard(tree->state->index_mutex, std::defer_lock);
+    if ( tree->concurrent ) {
+        guard.lock();
+    }
+#endif
+    MemberIndex &index = tree->state->member_indices[&*node->MemberBegin()];
+    if ( index.count != node->MemberCount() ) {
+        index_build(&index, node);
+    }
+    return &index;
 }
 
-int PropertyNode::getLen( const char *name ) {
-    if ( val->IsObject() ) {
-        if ( val->HasMember(name) ) {
-            Value &v = (*val)[name];
-            if ( v.IsArray() ) {
-                return v.Size();
+// find a member by explicit name length (no copy of the name is made)
+static Value *find_member(PropertyTree *tree, Value *node, const char *name,
+                          int len)
+{
+    MemberIndex *index = get_member_index(tree, node);
+    if ( index != nullptr ) {
+        Value::Member *members = &*node->MemberBegin();
+        uint32_t mask = index->slots.size() - 1;
+        uint32_t h = hash_name(name, len) & mask;
+        for ( ; index->slots[h] >= 0; h = (h + 1) & mask ) {
+            Value::Member &m = members[index->slots[h]];
+            if ( m.name.GetStringLength() == (SizeType)len
+                 and memcmp(m.name.GetString(), name, len) == 0 ) {
+                return &m.value;
             }
         }
+        return nullptr;
     }
-    return 0;
+    Value key(StringRef(name, len));
+    Value::MemberIterator itr = node->FindMember(key);
+    if ( itr != node->MemberEnd() ) {
+        return &itr->value;
+    }
+    return nullptr;
 }
 
-vector<string> PropertyNode::getChildren(bool expand) {
-    vector<string> result;
-    if ( val->IsObject() ) {
-        for (Value::ConstMemberIterator itr = val->MemberBegin(); itr != val->MemberEnd(); ++itr) {
-            string name = itr->name.GetString();
-            if ( expand and itr->value.IsArray() ) {
-                for ( int i = 0; i < itr->value.Size(); i++ ) {
-                    string ename = name + "/" + std::to_string(i);
-                    result.push_back(ename);
-                }
+static Value *find_member(PropertyTree *tree, Value *node, const char *name) {
+    return find_member(tree, node, name, strlen(name));
+}
+
+// add a member (key and value are moved into the tree) keeping any
+// member index current, returns the new member value
+static Value *add_member(PropertyTree *tree, Value *node, Value &key,
+                         Value &newval)
+{
+    if ( refuse_allocation(tree, "add member") ) {
+        return nullptr;
+    }
+    const Value::Member *old_members = nullptr;
+    if ( node->MemberCount() > 0 ) {
+        old_members = &*node->MemberBegin();
+    }
+    node->AddMember(key, newval, tree->doc->GetAllocator());
+    structure_changed(tree);
+    Value::Member *members = &*node->MemberBegin();
+    SizeType pos = node->MemberCount() - 1;
+    if ( old_members != nullptr ) {
+#if !defined(ARDUPILOT_BUILD)
+        std::unique_lock<std::mutex> guard(tree->state->index_mutex, std::defer_lock);
+        if ( tree->concurrent ) {
+            guard.lock();
+        }
+#endif
+        MemberIndexMap &member_indices = tree->state->member_indices;
+        auto itr = member_indices.find(old_members);
+        if ( itr != member_indices.end() ) {
+            if ( old_members != members ) {
+                // member storage was relocated, move the index with it
+                MemberIndex moved = std::move(itr->second);
+                member_indices.erase(itr);
+                member_indices[members] = std::move(moved);
+            }
+            MemberIndex &index = member_indices[members];
+            if ( index.count == pos and (pos + 1) * 2 <= index.slots.size() ) {
+                index_insert(&index, members, pos);
             } else {
-                result.push_back(name);
+                index.count = 0; // rebuild on next lookup
             }
         }
     }
-    return result;
+    return &members[pos].value;
 }
 
-static bool getValueAsBool( Value &v ) {
-    if ( v.IsBool() ) {
-        return v.GetBool();
-    } else if ( v.IsInt() ) {
-        return v.GetInt();
-    } else if ( v.IsUint() ) {
-        return v.GetUint();
-    } else if ( v.IsInt64() ) {
-        return v.GetInt64();
-    } else if ( v.IsUint64() ) {
-        return v.GetUint64();
-    } else if ( v.IsFloat() ) {
-        return v.GetFloat() == 0.0;
-    } else if ( v.IsDouble() ) {
-        return v.GetDouble() == 0.0;
-    } else if ( v.IsString() ) {
-        string s = v.GetString();
-        if ( s == "true" or s == "True" or s == "TRUE" ) {
-            return true;
-        } else {
-            return false;
-        }
-    } else {
-        printf("Unknown type in getValueAsBool()\n");
+static Value *add_member(PropertyTree *tree, Value *node, const char *name,
+                         int len, Value &newval)
+{
+    if ( refuse_allocation(tree, "add member") ) {
+        return nullptr;
     }
-    return false;
+    Value key;
+    key.SetString(name, len, tree->doc->GetAllocator());
+    return add_member(tree, node, key, newval);
 }
 
-static int getValueAsInt( Value &v ) {
-    if ( v.IsBool() ) {
-        return v.GetBool();
-    } else if ( v.IsInt() ) {
-        return v.GetInt();
-    } else if ( v.IsUint() ) {
-        return v.GetUint();
-    } else if ( v.IsInt64() ) {
-        return v.GetInt64();
-    } else if ( v.IsUint64() ) {
-        return v.GetUint64();
-    } else if ( v.IsFloat() ) {
-        return v.GetFloat();
-    } else if ( v.IsDouble() ) {
-        return v.GetDouble();
-    } else if ( v.IsString() ) {
-        string s = v.GetString();
-        return std::stoi(s);
-    } else {
-        printf("Unknown type in getValueAsInt()\n");
-    }
-    return 0;
+static Value *add_member(PropertyTree *tree, Value *node, const char *name,
+                         Value &newval)
+{
+    return add_member(tree, node, name, strlen(name), newval);
 }
 
-static unsigned int getValueAsUInt( Value &v ) {
-    if ( v.IsBool() ) {
-        return v.GetBool();
-    } else if ( v.IsInt() ) {
-        return v.GetInt();
-    } else if ( v.IsUint() ) {
-        return v.GetUint();
-    } else if ( v.IsInt64() ) {
-        return v.GetInt64();
-    } else if ( v.IsUint64() ) {
-        return v.GetUint64();
-    } else if ( v.IsFloat() ) {
-        return v.GetFloat();
-    } else if ( v.IsDouble() ) {
-        return v.GetDouble();
-    } else if ( v.IsString() ) {
-        string s = v.GetString();
-        return std::stoi(s);
-    } else {
-        printf("Unknown type in getValueAsUInt()\n");
+// remove a member (rapidjson moves the last member into the hole, so
+// any member index is dropped and rebuilt on demand)
+static bool remove_member(PropertyTree *tree, Value *node, const char *name) {
+    if ( node->MemberCount() == 0 ) {
+        return false;
     }
-    return 0;
+#if !defined(ARDUPILOT_BUILD)
+    std::unique_lock<std::mutex> guard(tree->state->index_mutex, std::defer_lock);
+    if ( tree->concurrent ) {
+        guard.lock();
+    }
+#endif
+    tree->state->member_indices.erase(&*node->MemberBegin());
+    structure_changed(tree);
+    return node->RemoveMember(name);
 }
 
-static float getValueAsFloat( Value &v ) {
-    if ( v.IsBool() ) {
-        return v.GetBool();
-    } else if ( v.IsInt() ) {
-        return v.GetInt();
-    } else if ( v.IsUint() ) {
-        return v.GetUint();
-    } else if ( v.IsInt64() ) {
-        return v.GetInt64();
-    } else if ( v.IsUint64() ) {
-        return v.GetUint64();
-    } else if ( v.IsFloat() ) {
-        return v.GetFloat();
-    } else if ( v.IsDouble() ) {
-        return v.GetDouble();
-    } else if ( v.IsString() ) {
-        string s = v.GetString();
-        return std::stof(s);
-    } else {
-        printf("Unknown type in getValueAsFloat()\n");
+static bool extend_array(PropertyTree *tree, Value *node, int size) {
+    if ( (!node->IsArray() or (int)node->Size() <= size)
+         and refuse_allocation(tree, "extend array") ) {
+        return false;
     }
-    return 0.0;
+    if ( !node->IsArray() ) {
+        node->SetArray();
+        structure_changed(tree);
+    }
+    for ( int i = node->Size(); i <= size; i++ ) {
+        PROPS2_DEBUG("    extending: %d\n", i);
+        Value newobj(kObjectType);
+        node->PushBack(newobj, tree->doc->GetAllocator());
+        structure_changed(tree);
+    }
+    return true;
 }
 
-static double getValueAsDouble( Value &v ) {
-    if ( v.IsBool() ) {
-        return v.GetBool();
-    } else if ( v.IsInt() ) {
-        return v.GetInt();
-    } else if ( v.IsUint() ) {
-        return v.GetUint();
-    } else if ( v.IsInt64() ) {
-        return v.GetInt64();
-    } else if ( v.IsUint64() ) {
-        return v.GetUint64();
-    } else if ( v.IsFloat() ) {
-        return v.GetFloat();
-    } else if ( v.IsDouble() ) {
-        return v.GetDouble();
-    } else if ( v.IsString() ) {
-        string s = v.GetString();
-        return std::stod(s);
-    } else {
-        printf("Unknown type in getValueAsDouble()\n");
+// records with this many children (a wide parameter table) get a hash
+// index of them so a lookup doesn't compare against every sibling
+static const size_t record_index_threshold = 16;
+
+static uint32_t record_hash(const char *name, int len, int index) {
+    if ( index >= 0 ) {
+        return (uint32_t)index * 2654435761u;
     }
-    return 0.0;
+    return hash_name(name, len);
 }
 
-static string getValueAsString( Value &v ) {
-    if ( v.IsBool() ) {
-        if ( v.GetBool() ) {
-            return "true";
-        } else {
-            return "false";
-        }
-    } else if ( v.IsInt() ) {
-        return std::to_string(v.GetInt());
-    } else if ( v.IsUint() ) {
-        return std::to_string(v.GetUint());
-    } else if ( v.IsInt64() ) {
-        return std::to_string(v.GetInt64());
-    } else if ( v.IsUint64() ) {
-        return std::to_string(v.GetUint64());
-    } else if ( v.IsFloat() ) {
-#if defined(ARDUPILOT_BUILD)
-        char buf[30];
-        hal.util->snprintf(buf, 30, "%f", v.GetFloat());
-        return buf;
-#else
-        return std::to_string(v.GetFloat());
-#endif
-    } else if ( v.IsDouble() ) {
-#if defined(ARDUPILOT_BUILD)
-        char buf[30];
-        hal.util->snprintf(buf, 30, "%lf", v.GetDouble());
-        return buf;
-#else
-        return std::to_string(v.GetDouble());
-#endif
-    } else if ( v.IsString() ) {
-        return v.GetString();
+static inline bool record_matches(const PropertyRecord *r, const char *name,
+                                  int len, int index)
+{
+    if ( r->index != index ) {
+        return false;
     }
-    printf("Unknown type in getValueAsString()\n");
-    return "unhandled value type";
+    return index >= 0 or (r->name.length() == (size_t)len
+                          and memcmp(r->name.data(), name, len) == 0);
 }
 
-bool PropertyNode::getBool( const char *name ) {
-    if ( val->IsObject() ) {
-        if ( val->HasMember(name) ) {
-            return getValueAsBool((*val)[name]);
-        }
+static void record_index_insert(PropertyRecord *parent, PropertyRecord *r) {
+    uint32_t mask = parent->slots.size() - 1;
+    uint32_t h = record_hash(r->name.data(), r->name.length(), r->index) & mask;
+    while ( parent->slots[h] != nullptr ) {
+        h = (h + 1) & mask;
     }
-    return false;
+    parent->slots[h] = r;
 }
 
-int PropertyNode::getInt( const char *name ) {
-    if ( val->IsObject() ) {
-        if ( val->HasMember(name) ) {
-            return getValueAsInt((*val)[name]);
+// find or create the record for a path step (nullptr if the record is
+// new and the tree's allocations are frozen: handles are then raw and
+// values set through them untracked)
+static PropertyRecord *child_record(PropertyTree *tree, PropertyRecord *parent,
+                                    const char *name, int len, int index)
+{
+    if ( !parent->slots.empty() ) {
+        uint32_t mask = parent->slots.size() - 1;
+        uint32_t h = record_hash(name, len, index) & mask;
+        for ( ; parent->slots[h] != nullptr; h = (h + 1) & mask ) {
+            if ( record_matches(parent->slots[h], name, len, index) ) {
+                return parent->slots[h];
+            }
+        }
+    } else {
+        for ( unsigned int i = 0; i < parent->children.size(); i++ ) {
+            PropertyRecord *r = parent->children[i];
+            if ( record_matches(r, name, len, index) ) {
+                return r;
+            }
         }
     }
-    return 0;
-}
-
-unsigned int PropertyNode::getUInt( const char *name ) {
-    if ( val->IsObject() ) {
-        if ( val->HasMember(name) ) {
-            return getValueAsUInt((*val)[name]);
+    if ( refuse_allocation(tree, "path record") ) {
+        return nullptr;
+    }
+    PropertyRecord *r = new PropertyRecord;
+    r->parent = parent;
+    r->index = index;
+    if ( index < 0 ) {
+        r->name.assign(name, len);
+    }
+    parent->children.push_back(r);
+    size_t count = parent->children.size();
+    if ( count * 2 > parent->slots.size() and count >= record_index_threshold ) {
+        size_t size = 2 * record_index_threshold;
+        while ( size < count * 4 ) {
+            size *= 2;
+        }
+        parent->slots.assign(size, nullptr);
+        for ( unsigned int i = 0; i < count; i++ ) {
+            record_index_insert(parent, parent->children[i]);
         }
+    } else if ( !parent->slots.empty() ) {
+        record_index_insert(parent, r);
     }
-    return 0;
+    return r;
 }
 
-float PropertyNode::getFloat( const char *name ) {
+// current value for a record (nullptr if it no longer exists)
+static Value *resolve_record(PropertyTree *tree, PropertyRecord *rec) {
+    if ( rec->gen == tree->structure_gen ) {
+        return rec->val;
+    }
+    if ( rec->parent == nullptr ) {
+        rec->val = tree->doc;
+    } else {
+        Value *parent = resolve_record(tree, rec->parent);
+        rec->val = nullptr;
+        if ( parent == nullptr ) {
+            // parent is gone
+        } else if ( rec->index >= 0 ) {
+            if ( parent->IsArray() and rec->index < (int)parent->Size() ) {
+                rec->val = &(*parent)[rec->index];
+            }
+        } else if ( parent->IsObject() ) {
+            rec->val = find_member(tree, parent, rec->name.data(),
+                                   rec->name.length());
+        }
+    }
+    rec->gen = tree->structure_gen;
+    return rec->val;
+}
+
+Value *props2_resolve(PropertyTree *tree, PropertyRecord *rec) {
+#if !defined(ARDUPILOT_BUILD)
+    if ( tree->concurrent ) {
+        std::lock_guard<std::mutex> guard(tree->state->resolve_mutex);
+        return resolve_record(tree, rec);
+    }
+#endif
+    return resolve_record(tree, rec);
+}
+
+// Change tracking: every setter bumps change_gen and stamps the record
+// of the value it set (touched) and all of its ancestors (changed) with
+// the new generation.  A consumer remembers getGeneration() and later
+// asks a node what changed since then, which only descends into records
+// changed after that generation.  Values set through raw nodes or
+// leaves (no record) aren't tracked.  Each tree has its own change_gen.
+void props2_touch(PropertyTree *tree, PropertyRecord *rec) {
+    uint64_t gen = gen_next(tree->state->change_gen, tree->concurrent);
+    gen_store(rec->touched, gen);
+    if ( tree->concurrent ) {
+        for ( ; rec != nullptr; rec = rec->parent ) {
+            gen_raise(rec->changed, gen);
+        }
+    } else {
+        for ( ; rec != nullptr; rec = rec->parent ) {
+            gen_store(rec->changed, gen);
+        }
+    }
+}
+
+int props2_lock(PropertyTree *tree, PropertyRecord *rec, int mode, bool leaf) {
+#if defined(ARDUPILOT_BUILD)
+    return -1;
+#else
+    if ( holds_structure == tree ) {
+        return -1;
+    }
+    if ( rec != nullptr and leaf ) {
+        rec = rec->parent;
+    }
+    if ( rec == nullptr ) {
+        mode = PROPS2_LOCK_STRUCTURE;
+    }
+    if ( mode == PROPS2_LOCK_STRUCTURE ) {
+        tree->state->lock.lock_exclusive();
+        holds_structure = tree;
+        return mode;
+    }
+    tree->state->lock.lock_shared();
+    if ( mode == PROPS2_LOCK_READ ) {
+        rec->lock.lock_shared();
+    } else {
+        rec->lock.lock_exclusive();
+    }
+    return mode;
+#endif
+}
+
+void props2_unlock(PropertyTree *tree, PropertyRecord *rec, int mode, bool leaf) {
+#if !defined(ARDUPILOT_BUILD)
+    if ( mode == PROPS2_LOCK_STRUCTURE ) {
+        holds_structure = nullptr;
+    } else {
+        if ( leaf ) {
+            rec = rec->parent;
+        }
+        rec->lock.unlock();
+    }
+    tree->state->lock.unlock();
+#endif
+}
+
+void PropertyTree::setConcurrent( bool enable ) {
+#if defined(ARDUPILOT_BUILD)
+    if ( enable ) {
+        PROPS2_WARN("concurrency mode not available\n");
+    }
+#else
+    concurrent = enable;
+#endif
+}
+
+void PropertyNode::setConcurrent( bool enable ) {
+    PropertyTree::getDefault()->setConcurrent(enable);
+}
+
+void PropertyTree::setStableHandles( bool enable ) {
+    state->stable_handles = enable;
+}
+
+void PropertyNode::setStableHandles( bool enable ) {
+    PropertyTree::getDefault()->setStableHandles(enable);
+}
+
+PropertyNode::PropertyNode() {
+}
+
+// return the next '/' separated token of a path (in place, not null
+// terminated) or nullptr when the path is exhausted
+static const char *next_token(const char *p, const char **token, int *len) {
+    while ( *p == '/' ) {
+        p++;
+    }
+    *token = p;
+    while ( *p and *p != '/' ) {
+        p++;
+    }
+    *len = p - *token;
+    if ( *len == 0 ) {
+        return nullptr;
+    }
+    return p;
+}
+
+// make sure a node is an object before walking/creating members
+static void check_object(PropertyTree *tree, Value *node) {
+    if ( !node->IsObject() ) {
+        check_replace(tree, node);
+        node->SetObject();
+        if ( !node->IsObject() ) {
+            PROPS2_ERROR("  still not object after setting to object.\n");
+        }              
+    }
+}
+
+// path step: array element reference
+static Value *step_index(PropertyTree *tree, Value *node, int index) {
+    if ( is_packed(*node) ) {
+        // elements are addressed individually, so back to a regular array
+        if ( refuse_allocation(tree, "unpack array") ) {
+            return nullptr;
+        }
+        unpack_array(*node, tree->doc->GetAllocator());
+    }
+    if ( !extend_array(tree, node, index+1) ) {
+        return nullptr;
+    }
+    // printf("Array size: %d\n", node->Size());
+    return &(*node)[index];
+}
+
+// path step: named member (optionally created)
+static Value *step_member(PropertyTree *tree, Value *node, const char *name,
+                          int len, bool create)
+{
+    if ( !node->IsObject() ) {
+        if ( !create ) {
+            return nullptr;
+        }
+        check_replace(tree, node);
+        node->SetObject();
+    }
+    Value *child = find_member(tree, node, name, len);
+    if ( child != nullptr ) {
+        // printf("    has %.*s\n", len, name);
+        return child;
+    } else if ( create ) {
+        PROPS2_DEBUG("    creating %.*s\n", len, name);
+        Value newobj(kObjectType);
+        // printf("  new node: %p\n", node);
+        return add_member(tree, node, name, len, newobj);
+    }
+    return nullptr;
+}
+
+// when node is an array and no index specified, default to /0
+static Value *default_element(Value *node) {
+    if ( node->IsArray() ) {
+        if ( node->Size() > 0 ) {
+            node = &(*node)[0];
+        }
+    }
+    // printf(" found/create node->%d\n", (int)node);
+    return node;
+}
+
+// walk the path tokens in place, resolving an existing path makes no
+// heap allocations
+static Value *walk_path(PropertyTree *tree, Value *start_node, const char *path,
+                        bool create)
+{
+    Value *node = start_node;
+    PROPS2_DEBUG("PropertyNode(%s)\n", path);
+    check_object(tree, node);
+    const char *token;
+    int len;
+    const char *p = path;
+    while ( (p = next_token(p, &token, &len)) != nullptr ) {
+        // printf("  token: %.*s\n", len, token);
+        int index;
+        if ( parse_index(token, len, &index) ) {
+            node = step_index(tree, node, index);
+        } else {
+            node = step_member(tree, node, token, len, create);
+        }
+        if ( node == nullptr ) {
+            return nullptr;
+        }
+    }
+    return node;
+}
+
+// step into an existing member or element without creating or
+// converting anything (read only nodes)
+static Value *lookup_step(PropertyTree *tree, Value *node, const char *name,
+                          int len, int index)
+{
+    if ( node == nullptr ) {
+        return nullptr;
+    }
+    if ( index >= 0 ) {
+        if ( !node->IsArray() or index >= (int)node->Size() ) {
+            return nullptr;
+        }
+        return &(*node)[index];
+    }
+    if ( !node->IsObject() ) {
+        return nullptr;
+    }
+    return find_member(tree, node, name, len);
+}
+
+static Value *lookup_path(PropertyTree *tree, Value *node, const char *path) {
+    const char *token;
+    int len;
+    const char *p = path;
+    while ( node != nullptr and (p = next_token(p, &token, &len)) != nullptr ) {
+        int index;
+        if ( !parse_index(token, len, &index) ) {
+            index = -1;
+        }
+        node = lookup_step(tree, node, token, len, index);
+    }
+    return node;
+}
+
+// records for each step of a path
+static PropertyRecord *record_for_path(PropertyTree *tree, PropertyRecord *rec,
+                                       const char *path)
+{
+    const char *token;
+    int len;
+    const char *p = path;
+    while ( rec != nullptr and (p = next_token(p, &token, &len)) != nullptr ) {
+        int index;
+        if ( !parse_index(token, len, &index) ) {
+            index = -1;
+        }
+        rec = child_record(tree, rec, token, len, index);
+    }
+    return rec;
+}
+
+// walk a precompiled path, no string parsing
+Value *PropertyPath::resolve(PropertyTree *tree, Value *start_node,
+                            bool create) const
+{
+    Value *node = start_node;
+    check_object(tree, node);
+    for ( unsigned int i = 0; i < tokens.size(); i++ ) {
+        const Token &t = tokens[i];
+        if ( t.index >= 0 ) {
+            node = step_index(tree, node, t.index);
+        } else {
+            node = step_member(tree, node, names.data() + t.name_pos,
+                               t.name_len, create);
+        }
+        if ( node == nullptr ) {
+            return nullptr;
+        }
+    }
+    return node;
+}
+
+Value *PropertyPath::lookup(PropertyTree *tree, Value *start_node) const {
+    Value *node = start_node;
+    for ( unsigned int i = 0; node != nullptr and i < tokens.size(); i++ ) {
+        const Token &t = tokens[i];
+        node = lookup_step(tree, node, names.data() + t.name_pos, t.name_len,
+                           t.index);
+    }
+    return node;
+}
+
+PropertyRecord *PropertyPath::record(PropertyTree *tree, PropertyRecord *rec) const {
+    for ( unsigned int i = 0; rec != nullptr and i < tokens.size(); i++ ) {
+        const Token &t = tokens[i];
+        rec = child_record(tree, rec, names.data() + t.name_pos, t.name_len,
+                           t.index);
+    }
+    return rec;
+}
+
+PropertyPath::PropertyPath(const char *path) {
+    absolute = (path[0] == '/');
+    const char *token;
+    int len;
+    const char *p = path;
+    while ( (p = next_token(p, &token, &len)) != nullptr ) {
+        Token t;
+        t.name_pos = names.length();
+        t.name_len = len;
+        if ( !parse_index(token, len, &t.index) ) {
+            t.index = -1;
+        }
+        names.append(token, len);
+        tokens.push_back(t);
+    }
+}
+
+PropertyPath::PropertyPath(const string &path):
+    PropertyPath(path.c_str())
+{
+}
+
+PropertyNode::PropertyNode(const char *abs_path, bool create):
+    PropertyNode(PropertyTree::getDefault(), abs_path, create)
+{
+}
+
+PropertyNode::PropertyNode(const string &abs_path, bool create):
+    PropertyNode(abs_path.c_str(), create)
+{
+}
+
+PropertyNode::PropertyNode(const PropertyPath &path, bool create):
+    PropertyNode(PropertyTree::getDefault(), path, create)
+{
+}
+
+PropertyNode::PropertyNode(Value *v) {
+    tree = PropertyTree::getDefault();
+    val = v;
+}
+
+PropertyNode::PropertyNode(PropertyTree *t, const char *abs_path, bool create) {
+    PropertyLock lock(t, nullptr, PROPS2_LOCK_STRUCTURE);
+    // printf("PropertyNode(%s) %d\n", abs_path, (int)&doc);
+    tree = t;
+    if ( abs_path[0] != '/' ) {
+        PROPS2_WARN("  not an absolute path\n");
+        return;
+    }
+    Value *node = walk_path(tree, tree->doc, abs_path, create);
+    PropertyRecord *path_rec = nullptr;
+    if ( tree->state->stable_handles and node != nullptr ) {
+        path_rec = record_for_path(tree, &tree->state->root, abs_path);
+    }
+    set_node(node, path_rec);
+    // pretty_print();
+}
+
+PropertyNode::PropertyNode(PropertyTree *t, const string &abs_path,
+                           bool create):
+    PropertyNode(t, abs_path.c_str(), create)
+{
+}
+
+PropertyNode::PropertyNode(PropertyTree *t, const PropertyPath &path,
+                           bool create)
+{
+    PropertyLock lock(t, nullptr, PROPS2_LOCK_STRUCTURE);
+    tree = t;
+    if ( !path.absolute ) {
+        PROPS2_WARN("  not an absolute path\n");
+        return;
+    }
+    Value *node = path.resolve(tree, tree->doc, create);
+    PropertyRecord *path_rec = nullptr;
+    if ( tree->state->stable_handles and node != nullptr ) {
+        path_rec = path.record(tree, &tree->state->root);
+    }
+    set_node(node, path_rec);
+}
+
+// point this node at a walked path value (with its path record for a
+// stable handle)
+void PropertyNode::set_node(Value *node, PropertyRecord *path_rec) {
+    val = nullptr;
+    rec = nullptr;
+    if ( node == nullptr ) {
+        return;
+    }
+    val = default_element(node);
+    if ( path_rec != nullptr ) {
+        if ( val != node ) {
+            // record the default element so we re-resolve to the same
+            path_rec = child_record(tree, path_rec, "", 0, 0);
+        }
+        rec = path_rec;
+        gen = tree->structure_gen;
+    }
+}
+
+void PropertyNode::rebind() {
+    val = props2_resolve(tree, rec);
+    gen = tree->structure_gen;
+}
+
+bool PropertyNode::hasChild( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return false;
+    }
+    if ( val->IsObject() ) {
+        if ( find_member(tree, val, name) != nullptr ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+PropertyNode PropertyNode::getChild( const char *name, bool create ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( !valid() ) {
+        return PropertyNode();
+    }
+    if ( read_only ) {
+        PropertyNode child;
+        child.set_node(lookup_path(tree, val, name), nullptr);
+        child.read_only = true;
+        return child;
+    }
+    if ( val->IsObject() ) {
+        PropertyNode child;
+        child.tree = tree;
+        Value *node = walk_path(tree, val, name, create);
+        PropertyRecord *path_rec = nullptr;
+        if ( rec != nullptr and node != nullptr ) {
+            path_rec = record_for_path(tree, rec, name);
+        }
+        child.set_node(node, path_rec);
+        return child;
+    }
+    PROPS2_WARN("%s not an object...\n", name);
+    return PropertyNode();
+}
+
+PropertyNode PropertyNode::getChild( const PropertyPath &path, bool create ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( !valid() ) {
+        return PropertyNode();
+    }
+    if ( read_only ) {
+        PropertyNode child;
+        child.set_node(path.lookup(tree, val), nullptr);
+        child.read_only = true;
+        return child;
+    }
+    if ( val->IsObject() ) {
+        PropertyNode child;
+        child.tree = tree;
+        Value *node = path.resolve(tree, val, create);
+        PropertyRecord *path_rec = nullptr;
+        if ( rec != nullptr and node != nullptr ) {
+            path_rec = path.record(tree, rec);
+        }
+        child.set_node(node, path_rec);
+        return child;
+    }
+    PROPS2_WARN("path not an object...\n");
+    return PropertyNode();
+}
+
+bool PropertyNode::isNull() {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    revalidate();
+    return val == nullptr;
+}
+
+int PropertyNode::getLen( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0;
+    }
+    if ( val->IsObject() ) {
+        Value *v = find_member(tree, val, name);
+        if ( v != nullptr and v->IsArray() ) {
+            return v->Size();
+        } else if ( v != nullptr and is_packed(*v) ) {
+            return packed_count(*v);
+        }
+    }
+    return 0;
+}
+
+vector<string> PropertyNode::getChildren(bool expand) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return vector<string>();
+    }
+    vector<string> result;
+    if ( val->IsObject() ) {
+        for (Value::ConstMemberIterator itr = val->MemberBegin(); itr != val->MemberEnd(); ++itr) {
+            string name = itr->name.GetString();
+            int len = -1;
+            if ( itr->value.IsArray() ) {
+                len = itr->value.Size();
+            } else if ( is_packed(itr->value) ) {
+                len = packed_count(itr->value);
+            }
+            if ( expand and len >= 0 ) {
+                for ( int i = 0; i < len; i++ ) {
+                    string ename = name + "/" + std::to_string(i);
+                    result.push_back(ename);
+                }
+            } else {
+                result.push_back(name);
+            }
+        }
+    }
+    return result;
+}
+
+static bool is_scalar(const Value &v) {
+    return !v.IsObject() and !v.IsArray() and !is_packed(v);
+}
+
+// children visited in place: one child (and node) reused for every
+// call, packed elements copied into a scratch value
+int PropertyNode::visitChildren( PropertyVisitor visit, void *ctx, bool expand ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( !valid() or !val->IsObject() ) {
+        return 0;
+    }
+    PropertyChild child;
+    child.node.tree = tree;
+    int count = 0;
+    for (Value::MemberIterator itr = val->MemberBegin(); itr != val->MemberEnd(); ++itr) {
+        Value &v = itr->value;
+        child.name = itr->name.GetString();
+        child.name_len = itr->name.GetStringLength();
+        child.node.read_only = read_only;
+        if ( expand and v.IsArray() ) {
+            for ( SizeType i = 0; i < v.Size(); i++ ) {
+                child.index = i;
+                child.leaf = is_scalar(v[i]);
+                child.node.val = &v[i];
+                count++;
+                if ( !visit(child, ctx) ) {
+                    return count;
+                }
+            }
+        } else if ( expand and is_packed(v) ) {
+            Value scratch;
+            child.leaf = true;
+            child.node.val = &scratch;
+            child.node.read_only = true;
+            int len = packed_count(v);
+            for ( int i = 0; i < len; i++ ) {
+                if ( packed_type(v) == PACKED_INT ) {
+                    scratch.SetInt(packed_get<int>(v, i));
+                } else {
+                    scratch.SetDouble(packed_get<double>(v, i));
+                }
+                child.index = i;
+                count++;
+                if ( !visit(child, ctx) ) {
+                    return count;
+                }
+            }
+        } else {
+            child.index = -1;
+            child.leaf = is_scalar(v);
+            child.node.val = &v;
+            count++;
+            if ( !visit(child, ctx) ) {
+                return count;
+            }
+        }
+    }
+    return count;
+}
+
+// Numeric strings: the value parsed from a string leaf is cached so
+// repeated numeric reads don't re-parse (or copy) the text.  The cache
+// is direct mapped by Value address and each entry keeps a copy of the
+// text it parsed, so a changed string (or a different Value reusing the
+// slot) is simply a miss.  Longer strings are parsed into the caller's
+// scratch entry each time.  Each thread has its own cache (concurrent
+// readers would otherwise fill the same slots.)
+struct NumericString {
+    const Value *v;
+    SizeType len;
+    char text[24];
+    bool valid;                 // text started with a number
+    double d;
+    long l;
+};
+
+static const int numeric_cache_size = 64;
+#if defined(ARDUPILOT_BUILD)
+static NumericString numeric_cache[numeric_cache_size];
+#else
+static thread_local NumericString numeric_cache[numeric_cache_size];
+#endif
+
+static void parse_numeric( const char *str, NumericString *n ) {
+    char *end;
+    n->d = strtod(str, &end);
+    n->valid = (end != str);
+    n->l = strtol(str, nullptr, 10);
+}
+
+static const NumericString *numeric_string( Value &v,
+                                            NumericString *scratch )
+{
+    const char *str = v.GetString();
+    SizeType len = v.GetStringLength();
+    NumericString *n = &numeric_cache[((uintptr_t)&v / sizeof(Value))
+                                      % numeric_cache_size];
+    if ( len >= sizeof(n->text) ) {
+        n = scratch;
+    } else if ( n->v == &v and n->len == len
+                and memcmp(n->text, str, len) == 0 ) {
+        return n;
+    } else {
+        n->v = &v;
+        n->len = len;
+        memcpy(n->text, str, len);
+    }
+    parse_numeric(str, n);
+    if ( !n->valid ) {
+        PROPS2_WARN("not a number: %s\n", str);
+    }
+    return n;
+}
+
+bool getValueAsBool( Value &v ) {
+    if ( v.IsBool() ) {
+        return v.GetBool();
+    } else if ( v.IsInt() ) {
+        return v.GetInt();
+    } else if ( v.IsUint() ) {
+        return v.GetUint();
+    } else if ( v.IsInt64() ) {
+        return v.GetInt64();
+    } else if ( v.IsUint64() ) {
+        return v.GetUint64();
+    } else if ( v.IsFloat() ) {
+        return v.GetFloat() == 0.0;
+    } else if ( v.IsDouble() ) {
+        return v.GetDouble() == 0.0;
+    } else if ( v.IsString() and !is_packed(v) ) {
+        const char *s = v.GetString();
+        if ( strcmp(s, "true") == 0 or strcmp(s, "True") == 0
+             or strcmp(s, "TRUE") == 0 ) {
+            return true;
+        } else {
+            return false;
+        }
+    } else {
+        PROPS2_WARN("Unknown type in getValueAsBool()\n");
+    }
+    return false;
+}
+
+int getValueAsInt( Value &v ) {
+    if ( v.IsBool() ) {
+        return v.GetBool();
+    } else if ( v.IsInt() ) {
+        return v.GetInt();
+    } else if ( v.IsUint() ) {
+        return v.GetUint();
+    } else if ( v.IsInt64() ) {
+        return v.GetInt64();
+    } else if ( v.IsUint64() ) {
+        return v.GetUint64();
+    } else if ( v.IsFloat() ) {
+        return v.GetFloat();
+    } else if ( v.IsDouble() ) {
+        return v.GetDouble();
+    } else if ( v.IsString() and !is_packed(v) ) {
+        NumericString scratch;
+        return numeric_string(v, &scratch)->l;
+    } else {
+        PROPS2_WARN("Unknown type in getValueAsInt()\n");
+    }
+    return 0;
+}
+
+unsigned int getValueAsUInt( Value &v ) {
+    if ( v.IsBool() ) {
+        return v.GetBool();
+    } else if ( v.IsInt() ) {
+        return v.GetInt();
+    } else if ( v.IsUint() ) {
+        return v.GetUint();
+    } else if ( v.IsInt64() ) {
+        return v.GetInt64();
+    } else if ( v.IsUint64() ) {
+        return v.GetUint64();
+    } else if ( v.IsFloat() ) {
+        return v.GetFloat();
+    } else if ( v.IsDouble() ) {
+        return v.GetDouble();
+    } else if ( v.IsString() and !is_packed(v) ) {
+        NumericString scratch;
+        return numeric_string(v, &scratch)->l;
+    } else {
+        PROPS2_WARN("Unknown type in getValueAsUInt()\n");
+    }
+    return 0;
+}
+
+float getValueAsFloat( Value &v ) {
+    if ( v.IsBool() ) {
+        return v.GetBool();
+    } else if ( v.IsInt() ) {
+        return v.GetInt();
+    } else if ( v.IsUint() ) {
+        return v.GetUint();
+    } else if ( v.IsInt64() ) {
+        return v.GetInt64();
+    } else if ( v.IsUint64() ) {
+        return v.GetUint64();
+    } else if ( v.IsFloat() ) {
+        return v.GetFloat();
+    } else if ( v.IsDouble() ) {
+        return v.GetDouble();
+    } else if ( v.IsString() and !is_packed(v) ) {
+        NumericString scratch;
+        return numeric_string(v, &scratch)->d;
+    } else {
+        PROPS2_WARN("Unknown type in getValueAsFloat()\n");
+    }
+    return 0.0;
+}
+
+double getValueAsDouble( Value &v ) {
+    if ( v.IsBool() ) {
+        return v.GetBool();
+    } else if ( v.IsInt() ) {
+        return v.GetInt();
+    } else if ( v.IsUint() ) {
+        return v.GetUint();
+    } else if ( v.IsInt64() ) {
+        return v.GetInt64();
+    } else if ( v.IsUint64() ) {
+        return v.GetUint64();
+    } else if ( v.IsFloat() ) {
+        return v.GetFloat();
+    } else if ( v.IsDouble() ) {
+        return v.GetDouble();
+    } else if ( v.IsString() and !is_packed(v) ) {
+        NumericString scratch;
+        return numeric_string(v, &scratch)->d;
+    } else {
+        PROPS2_WARN("Unknown type in getValueAsDouble()\n");
+    }
+    return 0.0;
+}
+
+string getValueAsString( Value &v ) {
+    if ( v.IsBool() ) {
+        if ( v.GetBool() ) {
+            return "true";
+        } else {
+            return "false";
+        }
+    } else if ( v.IsInt() ) {
+        return std::to_string(v.GetInt());
+    } else if ( v.IsUint() ) {
+        return std::to_string(v.GetUint());
+    } else if ( v.IsInt64() ) {
+        return std::to_string(v.GetInt64());
+    } else if ( v.IsUint64() ) {
+        return std::to_string(v.GetUint64());
+    } else if ( v.IsFloat() ) {
+#if defined(ARDUPILOT_BUILD)
+        char buf[30];
+        hal.util->snprintf(buf, 30, "%f", v.GetFloat());
+        return buf;
+#else
+        return std::to_string(v.GetFloat());
+#endif
+    } else if ( v.IsDouble() ) {
+#if defined(ARDUPILOT_BUILD)
+        char buf[30];
+        hal.util->snprintf(buf, 30, "%lf", v.GetDouble());
+        return buf;
+#else
+        return std::to_string(v.GetDouble());
+#endif
+    } else if ( v.IsString() and !is_packed(v) ) {
+        return v.GetString();
+    }
+    PROPS2_WARN("Unknown type in getValueAsString()\n");
+    return "unhandled value type";
+}
+
+bool PropertyNode::getBool( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return false;
+    }
+    if ( val->IsObject() ) {
+        Value *v = find_member(tree, val, name);
+        if ( v != nullptr ) {
+            return getValueAsBool(*v);
+        }
+    }
+    return false;
+}
+
+int PropertyNode::getInt( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0;
+    }
+    if ( val->IsObject() ) {
+        Value *v = find_member(tree, val, name);
+        if ( v != nullptr ) {
+            return getValueAsInt(*v);
+        }
+    }
+    return 0;
+}
+
+unsigned int PropertyNode::getUInt( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0;
+    }
+    if ( val->IsObject() ) {
+        Value *v = find_member(tree, val, name);
+        if ( v != nullptr ) {
+            return getValueAsUInt(*v);
+        }
+    }
+    return 0;
+}
+
+float PropertyNode::getFloat( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0.0;
+    }
     if ( val->IsObject() ) {
-        if ( val->HasMember(name) ) {
-            return getValueAsFloat((*val)[name]);
+        Value *v = find_member(tree, val, name);
+        if ( v != nullptr ) {
+            return getValueAsFloat(*v);
         // } else {
         //     printf("no member in getFloat(%s)\n", name);
         }
     } else {
-        printf("v is not an object\n");
+        PROPS2_WARN("v is not an object\n");
+    }
+    return 0.0;
+}
+
+double PropertyNode::getDouble( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0.0;
+    }
+    if ( val->IsObject() ) {
+        Value *v = find_member(tree, val, name);
+        if ( v != nullptr ) {
+            return getValueAsDouble(*v);
+        }
+    }
+    return 0.0;
+}
+
+string PropertyNode::getString( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return (string)name + ": not an object";
+    }
+    if ( val->IsObject() ) {
+        Value *v = find_member(tree, val, name);
+        if ( v != nullptr ) {
+            return getValueAsString(*v);
+        } else {
+            return (string)name + ": not a member";
+        }
+    }
+    return (string)name + ": not an object";
+}
+
+// find or create a member to bind a leaf handle to
+static Value *bind_member(PropertyTree *tree, Value *val, const char *name,
+                          Value &init)
+{
+    if ( !val->IsObject() ) {
+        check_replace(tree, val);
+        val->SetObject();
+    }
+    Value *v = find_member(tree, val, name);
+    if ( v == nullptr ) {
+        PROPS2_DEBUG("creating %s\n", name);
+        v = add_member(tree, val, name, init);
+    }
+    return v;
+}
+
+// record for a leaf bound under a stable node
+static PropertyRecord *leaf_record(PropertyTree *tree, PropertyRecord *rec,
+                                   const char *name)
+{
+    if ( rec == nullptr ) {
+        return nullptr;
+    }
+    return child_record(tree, rec, name, strlen(name), -1);
+}
+
+// stamp member name of a stable node as changed
+static void touch_member(PropertyTree *tree, PropertyRecord *rec,
+                         const char *name)
+{
+    PropertyRecord *r = leaf_record(tree, rec, name);
+    if ( r != nullptr ) {
+        props2_touch(tree, r);
+    }
+}
+
+PropertyLeaf<bool> PropertyNode::bindBool( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() ) {
+        return PropertyLeaf<bool>();
+    }
+    Value init(false);
+    Value *v = bind_member(tree, val, name, init);
+    if ( v == nullptr ) {
+        return PropertyLeaf<bool>();
+    }
+    return PropertyLeaf<bool>(tree, v, leaf_record(tree, rec, name));
+}
+
+PropertyLeaf<int> PropertyNode::bindInt( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() ) {
+        return PropertyLeaf<int>();
+    }
+    Value init(0);
+    Value *v = bind_member(tree, val, name, init);
+    if ( v == nullptr ) {
+        return PropertyLeaf<int>();
+    }
+    return PropertyLeaf<int>(tree, v, leaf_record(tree, rec, name));
+}
+
+PropertyLeaf<unsigned int> PropertyNode::bindUInt( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() ) {
+        return PropertyLeaf<unsigned int>();
+    }
+    Value init(0u);
+    Value *v = bind_member(tree, val, name, init);
+    if ( v == nullptr ) {
+        return PropertyLeaf<unsigned int>();
+    }
+    return PropertyLeaf<unsigned int>(tree, v, leaf_record(tree, rec, name));
+}
+
+PropertyLeaf<float> PropertyNode::bindFloat( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() ) {
+        return PropertyLeaf<float>();
+    }
+    Value init(0.0f);
+    Value *v = bind_member(tree, val, name, init);
+    if ( v == nullptr ) {
+        return PropertyLeaf<float>();
+    }
+    return PropertyLeaf<float>(tree, v, leaf_record(tree, rec, name));
+}
+
+PropertyLeaf<double> PropertyNode::bindDouble( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() ) {
+        return PropertyLeaf<double>();
+    }
+    Value init(0.0);
+    Value *v = bind_member(tree, val, name, init);
+    if ( v == nullptr ) {
+        return PropertyLeaf<double>();
+    }
+    return PropertyLeaf<double>(tree, v, leaf_record(tree, rec, name));
+}
+
+// Wildcard queries: the pattern is matched against the values under
+// the base node, collecting each leaf (its value and the steps down to
+// it, members by name and array elements by index), then each match is
+// bound straight to its value with records made for those steps.  Only
+// existing numeric members match and nothing is looked up by path, so
+// nothing is created or converted (a member named "1" stays a member.)
+// "**" can reach a leaf along more than one route, so matches are
+// de-duplicated.
+struct QueryStep {
+    const char *name;           // member name (len chars), or
+    int len;
+    int index;                  // array element (name unused) or -1
+};
+
+struct QueryMatch {
+    string path;                // relative path of the leaf
+    vector<QueryStep> steps;    // from the base to the leaf
+    Value *val;
+};
+
+static string join_path(const string &parent, const char *name, int len) {
+    string path = parent;
+    if ( !path.empty() ) {
+        path += '/';
+    }
+    path.append(name, len);
+    return path;
+}
+
+static void query_match(Value *v, const vector<string> &tokens,
+                        unsigned int ti, const string &path,
+                        vector<QueryStep> &steps,
+                        vector<QueryMatch> &matches)
+{
+    const string &tok = tokens[ti];
+    if ( ti == tokens.size() - 1 ) {
+        if ( !v->IsObject() ) {
+            return;
+        }
+        for (Value::MemberIterator itr = v->MemberBegin(); itr != v->MemberEnd(); ++itr) {
+            if ( (tok == "*" or tok == itr->name.GetString())
+                 and itr->value.IsNumber() ) {
+                QueryStep step = { itr->name.GetString(),
+                                   (int)itr->name.GetStringLength(), -1 };
+                QueryMatch m;
+                m.path = join_path(path, step.name, step.len);
+                m.steps = steps;
+                m.steps.push_back(step);
+                m.val = &itr->value;
+                matches.push_back(m);
+            }
+        }
+        return;
+    }
+    if ( tok == "**" ) {
+        query_match(v, tokens, ti + 1, path, steps, matches);
+    }
+    bool any = (tok == "*" or tok == "**");
+    unsigned int next = (tok == "**") ? ti : ti + 1;
+    if ( v->IsObject() ) {
+        for (Value::MemberIterator itr = v->MemberBegin(); itr != v->MemberEnd(); ++itr) {
+            Value &c = itr->value;
+            if ( (c.IsObject() or c.IsArray())
+                 and (any or tok == itr->name.GetString()) ) {
+                QueryStep step = { itr->name.GetString(),
+                                   (int)itr->name.GetStringLength(), -1 };
+                steps.push_back(step);
+                query_match(&c, tokens, next,
+                            join_path(path, step.name, step.len),
+                            steps, matches);
+                steps.pop_back();
+            }
+        }
+    } else if ( v->IsArray() ) {
+        int index;
+        bool indexed = parse_index(tok.c_str(), tok.length(), &index);
+        for ( SizeType i = 0; i < v->Size(); i++ ) {
+            Value &c = (*v)[i];
+            if ( (c.IsObject() or c.IsArray())
+                 and (any or (indexed and index == (int)i)) ) {
+                string num = std::to_string(i);
+                QueryStep step = { nullptr, 0, (int)i };
+                steps.push_back(step);
+                query_match(&c, tokens, next,
+                            join_path(path, num.c_str(), num.length()),
+                            steps, matches);
+                steps.pop_back();
+            }
+        }
+    }
+}
+
+PropertyQuery PropertyNode::query( const char *pattern ) {
+    PropertyQuery q;
+    if ( tree == nullptr ) {
+        // snapshot or null node: nothing to bind
+    } else if ( pattern[0] == '/' ) {
+        q.base = PropertyNode(tree, "/", false);
+    } else {
+        q.base = *this;
+    }
+    q.pattern = pattern;
+    q.refresh();
+    return q;
+}
+
+bool PropertyQuery::refresh() {
+    paths.clear();
+    leaves.clear();
+    vector<string> tokens;
+    const char *token;
+    int len;
+    const char *p = pattern.c_str();
+    while ( (p = next_token(p, &token, &len)) != nullptr ) {
+        tokens.push_back(string(token, len));
+    }
+    int index;
+    if ( tokens.empty() or tokens.back() == "**"
+         or parse_index(tokens.back().c_str(), tokens.back().length(), &index) ) {
+        PROPS2_WARN("query needs a leaf name: %s\n", pattern.c_str());
+        return false;
+    }
+    if ( base.tree == nullptr ) {
+        return true;            // nothing to bind in a snapshot
+    }
+    PropertyLock lock(base.tree, nullptr, PROPS2_LOCK_STRUCTURE);
+    if ( !base.valid() ) {
+        return true;
+    }
+    vector<QueryStep> steps;
+    vector<QueryMatch> matches;
+    query_match(base.val, tokens, 0, "", steps, matches);
+    std::unordered_set<string> seen;
+    for ( unsigned int i = 0; i < matches.size(); i++ ) {
+        QueryMatch &m = matches[i];
+        if ( !seen.insert(m.path).second ) {
+            continue;
+        }
+        PropertyRecord *rec = base.rec;
+        for ( unsigned int j = 0; j < m.steps.size() and rec != nullptr; j++ ) {
+            const QueryStep &step = m.steps[j];
+            rec = child_record(base.tree, rec, step.name, step.len, step.index);
+        }
+        paths.push_back(m.path);
+        leaves.push_back(PropertyLeaf<double>(base.tree, m.val, rec));
+    }
+    return true;
+}
+
+// leaves removed since the query read as 0 and ignore sets
+int PropertyQuery::getDoubles( double *dst, int count ) {
+    int n = count < size() ? count : size();
+    for ( int i = 0; i < n; i++ ) {
+        dst[i] = leaves[i].get();
+    }
+    return n;
+}
+
+int PropertyQuery::setDoubles( const double *src, int count ) {
+    int n = count < size() ? count : size();
+    for ( int i = 0; i < n; i++ ) {
+        leaves[i].set_number(src[i]);
+    }
+    return n;
+}
+
+int PropertyQuery::getFloats( float *dst, int count ) {
+    int n = count < size() ? count : size();
+    for ( int i = 0; i < n; i++ ) {
+        dst[i] = leaves[i].get();
+    }
+    return n;
+}
+
+int PropertyQuery::setFloats( const float *src, int count ) {
+    int n = count < size() ? count : size();
+    for ( int i = 0; i < n; i++ ) {
+        leaves[i].set_number(src[i]);
+    }
+    return n;
+}
+
+uint64_t PropertyTree::getGeneration() {
+    return gen_load(state->change_gen);
+}
+
+uint64_t PropertyNode::getGeneration() {
+    return PropertyTree::getDefault()->getGeneration();
+}
+
+// A load() or readBinary() into a node, or a container replaced by a
+// setter, stamps only that node, but everything below it changed too:
+// set_above() is the latest such set of any ancestor of a record
+static uint64_t set_above(const PropertyRecord *rec) {
+    uint64_t gen = 0;
+    for ( const PropertyRecord *r = rec->parent; r != nullptr; r = r->parent ) {
+        uint64_t touched = gen_load(r->touched);
+        if ( touched > gen ) {
+            gen = touched;
+        }
+    }
+    return gen;
+}
+
+// generation a record's value (or anything under it) last changed at
+static uint64_t changed_at(const PropertyRecord *rec) {
+    uint64_t gen = gen_load(rec->changed);
+    uint64_t above = set_above(rec);
+    return above > gen ? above : gen;
+}
+
+bool PropertyNode::changedSince( uint64_t gen ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return false;
+    }
+    if ( rec == nullptr ) {
+        return true;            // untracked, assume it may have
+    }
+    return changed_at(rec) > gen;
+}
+
+// append the paths (relative to rec) of values changed since gen: the
+// topmost value set as a whole, otherwise descend into changed children
+static void find_changes(PropertyRecord *rec, uint64_t gen, const string &path,
+                         vector<string> &result)
+{
+    if ( gen_load(rec->touched) > gen ) {
+        result.push_back(path);
+        return;
+    }
+    for ( unsigned int i = 0; i < rec->children.size(); i++ ) {
+        PropertyRecord *r = rec->children[i];
+        if ( gen_load(r->changed) <= gen ) {
+            continue;
+        }
+        string child_path = path;
+        if ( !child_path.empty() ) {
+            child_path += "/";
+        }
+        if ( r->index >= 0 ) {
+            child_path += std::to_string(r->index);
+        } else {
+            child_path += r->name;
+        }
+        find_changes(r, gen, child_path, result);
+    }
+}
+
+vector<string> PropertyNode::getChangedSince( uint64_t gen ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    vector<string> result;
+    if ( !valid() ) {
+        return result;
+    }
+    if ( rec == nullptr ) {
+        result.push_back("");   // untracked, report the whole node
+    } else if ( set_above(rec) > gen ) {
+        result.push_back("");   // replaced along with an ancestor
+    } else if ( gen_load(rec->changed) > gen ) {
+        find_changes(rec, gen, "", result);
+    }
+    return result;
+}
+
+// Subscriptions remember the change generation they were last
+// delivered at and dispatch() compares that with their record's stamp,
+// so a setter pays nothing extra for being watched.  Entries are only
+// freed by dispatch() (not while callbacks run) so a callback may
+// subscribe or unsubscribe.  The list is guarded by the structure
+// lock, which dispatch() holds while callbacks run (their own tree
+// calls nest inside it.)
+struct Subscription {
+    int id;                     // 0 once unsubscribed
+    PropertyRecord *rec;
+    string path;
+    uint64_t seen;              // change_gen last delivered at
+    PropertyCallback cb;
+};
+
+// absolute path of a record
+static string record_path(const PropertyRecord *rec) {
+    string path;
+    for ( ; rec->parent != nullptr; rec = rec->parent ) {
+        if ( rec->index >= 0 ) {
+            path = "/" + std::to_string(rec->index) + path;
+        } else {
+            path = "/" + rec->name + path;
+        }
+    }
+    return path.empty() ? "/" : path;
+}
+
+int PropertyNode::subscribe( const char *path, PropertyCallback cb ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() ) {
+        return -1;
+    }
+    if ( rec == nullptr ) {
+        PROPS2_WARN("can't subscribe to %s under an untracked node\n", path);
+        return -1;
+    }
+    if ( refuse_allocation(tree, "subscribe") ) {
+        return -1;
+    }
+    PropertyTreeState *state = tree->state;
+    Subscription *sub = new Subscription;
+    sub->id = state->next_subscription_id++;
+    sub->rec = record_for_path(tree, rec, path);
+    sub->path = record_path(sub->rec);
+    sub->seen = gen_load(state->change_gen);
+    sub->cb = cb;
+    state->subscriptions.push_back(sub);
+    return sub->id;
+}
+
+void PropertyTree::unsubscribe( int id ) {
+    PropertyLock lock(this, nullptr, PROPS2_LOCK_STRUCTURE);
+    vector<Subscription *> &subscriptions = state->subscriptions;
+    for ( unsigned int i = 0; i < subscriptions.size(); i++ ) {
+        if ( subscriptions[i]->id == id ) {
+            subscriptions[i]->id = 0;
+        }
+    }
+}
+
+int PropertyTree::dispatch() {
+    PropertyLock lock(this, nullptr, PROPS2_LOCK_STRUCTURE);
+    if ( state->dispatching ) {
+        return 0;
+    }
+    vector<Subscription *> &subscriptions = state->subscriptions;
+    unsigned int n = 0;
+    for ( unsigned int i = 0; i < subscriptions.size(); i++ ) {
+        if ( subscriptions[i]->id == 0 ) {
+            delete subscriptions[i];
+        } else {
+            subscriptions[n++] = subscriptions[i];
+        }
+    }
+    subscriptions.resize(n);
+
+    // changes made by callbacks (and their new subscriptions) are
+    // delivered next time
+    state->dispatching = true;
+    uint64_t now = gen_load(state->change_gen);
+    int calls = 0;
+    for ( unsigned int i = 0; i < n; i++ ) {
+        Subscription *sub = subscriptions[i];
+        if ( sub->id != 0 and changed_at(sub->rec) > sub->seen ) {
+            sub->seen = now;
+            sub->cb(sub->path);
+            calls++;
+        }
+    }
+    state->dispatching = false;
+    return calls;
+}
+
+void PropertyNode::unsubscribe( int id ) {
+    PropertyTree::getDefault()->unsubscribe(id);
+}
+
+int PropertyNode::dispatch() {
+    return PropertyTree::getDefault()->dispatch();
+}
+
+// Snapshots: publishSnapshot() copies a subtree into a new document
+// and makes it the latest snapshot of the node's path with an atomic
+// pointer exchange, so the publishing thread never waits for readers.
+// A reader pins the snapshot it loaded in a hazard slot (and checks it
+// is still the latest after announcing it), and replaced snapshots are
+// freed by a later publish once no slot holds them.  Each tree has its
+// own set of paths (channels), but the hazard slots and the retired
+// list are process wide: max_snapshot_readers snapshots can be held at
+// once across all trees.  Not available on ArduPilot builds.
+struct SnapshotData {
+    Document doc;               // the copy (with its own allocator)
+    uint64_t gen;               // change generation it was taken at
+};
+
+#if !defined(ARDUPILOT_BUILD)
+struct SnapshotChannel {
+    string path;
+    std::atomic<SnapshotData *> current;
+};
+
+static const int max_snapshot_readers = 32; // snapshots pinned at once
+static std::atomic<SnapshotData *> hazards[max_snapshot_readers];
+static std::atomic<bool> hazard_used[max_snapshot_readers];
+
+static std::mutex retire_mutex;
+static vector<SnapshotData *> retired;      // replaced, maybe still read
+
+// "/a/b" form of an absolute path
+static string canonical_path(const char *path) {
+    string result;
+    const char *token;
+    int len;
+    const char *p = path;
+    while ( (p = next_token(p, &token, &len)) != nullptr ) {
+        result += "/";
+        result.append(token, len);
+    }
+    return result.empty() ? "/" : result;
+}
+
+static SnapshotChannel *find_channel(PropertyTree *tree, const string &path,
+                                     bool create)
+{
+    std::lock_guard<std::mutex> guard(tree->state->channel_mutex);
+    vector<SnapshotChannel *> &channels = tree->state->channels;
+    for ( unsigned int i = 0; i < channels.size(); i++ ) {
+        if ( channels[i]->path == path ) {
+            return channels[i];
+        }
+    }
+    if ( !create ) {
+        return nullptr;
+    }
+    SnapshotChannel *channel = new SnapshotChannel;
+    channel->path = path;
+    channel->current.store(nullptr);
+    channels.push_back(channel);
+    return channel;
+}
+
+// free the retired snapshots no reader has pinned
+static void reclaim_snapshots() {
+    SnapshotData *pinned[max_snapshot_readers];
+    for ( int i = 0; i < max_snapshot_readers; i++ ) {
+        pinned[i] = hazards[i].load();
+    }
+    unsigned int n = 0;
+    for ( unsigned int i = 0; i < retired.size(); i++ ) {
+        SnapshotData *snap = retired[i];
+        bool in_use = false;
+        for ( int j = 0; j < max_snapshot_readers and !in_use; j++ ) {
+            in_use = (pinned[j] == snap);
+        }
+        if ( in_use ) {
+            retired[n++] = snap;
+        } else {
+            delete snap;
+        }
+    }
+    retired.resize(n);
+}
+#endif
+
+bool PropertyNode::publishSnapshot() {
+#if defined(ARDUPILOT_BUILD)
+    PROPS2_WARN("snapshots not available\n");
+    return false;
+#else
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
+    if ( rec == nullptr ) {
+        PROPS2_WARN("can't publish a snapshot of an untracked node\n");
+        return false;
+    }
+    if ( rec->channel == nullptr ) {
+        rec->channel = find_channel(tree, record_path(rec), true);
+    }
+    SnapshotData *snap = new SnapshotData;
+    snap->gen = gen_load(tree->state->change_gen);
+    // const strings too: packed arrays are modified in place
+    snap->doc.CopyFrom(*val, snap->doc.GetAllocator(), true);
+    SnapshotData *old = rec->channel->current.exchange(snap);
+    std::lock_guard<std::mutex> guard(retire_mutex);
+    if ( old != nullptr ) {
+        retired.push_back(old);
+    }
+    reclaim_snapshots();
+    return true;
+#endif
+}
+
+PropertySnapshot::PropertySnapshot(const char *abs_path):
+    PropertySnapshot(PropertyTree::getDefault(), abs_path)
+{
+}
+
+PropertySnapshot::PropertySnapshot(PropertyTree *tree, const char *abs_path) {
+#if !defined(ARDUPILOT_BUILD)
+    SnapshotChannel *channel = find_channel(tree, canonical_path(abs_path),
+                                            false);
+    if ( channel == nullptr ) {
+        return;
+    }
+    for ( int i = 0; i < max_snapshot_readers and slot < 0; i++ ) {
+        bool expected = false;
+        if ( hazard_used[i].compare_exchange_strong(expected, true) ) {
+            slot = i;
+        }
+    }
+    if ( slot < 0 ) {
+        PROPS2_WARN("too many snapshots held\n");
+        return;
+    }
+    SnapshotData *current = channel->current.load();
+    do {
+        snap = current;
+        hazards[slot].store(snap);
+        current = channel->current.load();
+    } while ( current != snap );
+#endif
+}
+
+PropertySnapshot::~PropertySnapshot() {
+#if !defined(ARDUPILOT_BUILD)
+    if ( slot >= 0 ) {
+        hazards[slot].store(nullptr);
+        hazard_used[slot].store(false);
+    }
+#endif
+}
+
+PropertyNode PropertySnapshot::getNode() {
+    PropertyNode node;
+    if ( snap != nullptr ) {
+        node.val = &snap->doc;
+        node.read_only = true;
+    }
+    return node;
+}
+
+uint64_t PropertySnapshot::getGeneration() {
+    return snap != nullptr ? snap->gen : 0;
+}
+
+PropertyTree::PropertyTree() {
+    owned_doc = new Document;
+    doc = owned_doc;
+    state = new PropertyTreeState;
+}
+
+PropertyTree::PropertyTree( Document *d ) {
+    doc = d;
+    state = new PropertyTreeState;
+}
+
+PropertyTree::PropertyTree( size_t arena_size ) {
+    state = new PropertyTreeState;
+    state->arena = (char *)malloc(arena_size);
+    if ( state->arena == nullptr ) {
+        PROPS2_ERROR("no memory for a %ld byte arena\n", (long)arena_size);
+        owned_doc = new Document;
+    } else {
+        state->arena_size = arena_size;
+        state->arena_allocator = new MemoryPoolAllocator<>(state->arena,
+                                                           arena_size);
+        owned_doc = new Document(state->arena_allocator);
     }
-    return 0.0;
+    doc = owned_doc;
 }
 
-double PropertyNode::getDouble( const char *name ) {
-    if ( val->IsObject() ) {
-        if ( val->HasMember(name) ) {
-            return getValueAsDouble((*val)[name]);
+// the default tree is the global doc (never destroyed, so handles in
+// static objects stay safe at exit)
+PropertyTree *PropertyTree::getDefault() {
+    static PropertyTree *tree = new PropertyTree(&::doc);
+    return tree;
+}
+
+static void free_records(PropertyRecord *rec) {
+    for ( unsigned int i = 0; i < rec->children.size(); i++ ) {
+        free_records(rec->children[i]);
+        delete rec->children[i];
+    }
+}
+
+// no snapshot of the tree may still be held
+PropertyTree::~PropertyTree() {
+    free_records(&state->root);
+    for ( unsigned int i = 0; i < state->subscriptions.size(); i++ ) {
+        delete state->subscriptions[i];
+    }
+#if !defined(ARDUPILOT_BUILD)
+    for ( unsigned int i = 0; i < state->channels.size(); i++ ) {
+        delete state->channels[i]->current.load();
+        delete state->channels[i];
+    }
+#endif
+    delete owned_doc;
+#if !defined(ARDUPILOT_BUILD)
+    // after the document, which has values in them
+    for ( unsigned int i = 0; i < state->include_allocators.size(); i++ ) {
+        delete state->include_allocators[i];
+    }
+#endif
+    delete state->arena_allocator;
+    free(state->arena);
+    delete state;
+}
+
+// build the member index of every wide object now rather than lazily
+// on its first lookup
+static void build_member_indices(PropertyTree *tree, Value *v) {
+    if ( v->IsObject() ) {
+        get_member_index(tree, v);
+        for ( Value::MemberIterator itr = v->MemberBegin(); itr != v->MemberEnd(); ++itr ) {
+            build_member_indices(tree, &itr->value);
+        }
+    } else if ( v->IsArray() ) {
+        for ( Value::ValueIterator e = v->Begin(); e != v->End(); ++e ) {
+            build_member_indices(tree, e);
         }
     }
-    return 0.0;
 }
 
-string PropertyNode::getString( const char *name ) {
-    if ( val->IsObject() ) {
-        if ( val->HasMember(name) ) {
-            return getValueAsString((*val)[name]);
+// create the records of every member (and container element) now so
+// setting existing values after the freeze can stamp them
+static void build_records(PropertyTree *tree, PropertyRecord *rec, Value *v) {
+    if ( v->IsObject() ) {
+        for ( Value::MemberIterator itr = v->MemberBegin(); itr != v->MemberEnd(); ++itr ) {
+            PropertyRecord *r = child_record(tree, rec, itr->name.GetString(),
+                                             itr->name.GetStringLength(), -1);
+            build_records(tree, r, &itr->value);
+        }
+    } else if ( v->IsArray() ) {
+        for ( SizeType i = 0; i < v->Size(); i++ ) {
+            Value &e = (*v)[i];
+            if ( e.IsObject() or e.IsArray() ) {
+                build_records(tree, child_record(tree, rec, "", 0, i), &e);
+            }
+        }
+    }
+}
+
+void PropertyTree::freezeAllocations() {
+    PropertyLock lock(this, nullptr, PROPS2_LOCK_STRUCTURE);
+    build_member_indices(this, doc);
+    build_records(this, &state->root, doc);
+    PropertyArenaStats stats = getArenaStats();
+    if ( stats.arena_size > 0 and stats.capacity > stats.arena_size ) {
+        PROPS2_WARN("arena overflowed onto the heap (%ld bytes used of %ld)\n",
+                    (long)stats.high_water, (long)stats.arena_size);
+    }
+    state->frozen = true;
+    state->refused = 0;
+}
+
+bool PropertyTree::allocationsFrozen() {
+    return state->frozen;
+}
+
+PropertyArenaStats PropertyTree::getArenaStats() {
+    PropertyLock lock(this, nullptr, PROPS2_LOCK_STRUCTURE);
+    PropertyArenaStats stats;
+    stats.arena_size = state->arena_size;
+    stats.high_water = doc->GetAllocator().Size();
+    stats.capacity = doc->GetAllocator().Capacity();
+    stats.frozen = state->frozen;
+    stats.refused = count_load(state->refused);
+    return stats;
+}
+
+// Memory accounting: allocator bytes come from the pools, live bytes
+// from walking the values and adding up the blocks they point to
+// (rounded as the pool rounds them.)  Strings short enough to be stored
+// inside the Value take no block; in situ strings are counted as if
+// copied, their text being in the tree's allocator too.
+static const SizeType inline_string_max = 13;
+
+static SizeType string_capacity(PropertyTree *tree, const Value &v);
+
+static size_t string_bytes(PropertyTree *tree, const Value &v) {
+    SizeType cap = string_capacity(tree, v);
+    if ( cap > 0 ) {
+        return cap;             // a string leaf buffer
+    }
+    SizeType len = v.GetStringLength();
+    return len > inline_string_max ? RAPIDJSON_ALIGN(len + 1) : 0;
+}
+
+static void count_live(PropertyTree *tree, const Value &v,
+                       PropertyMemoryStats *stats)
+{
+    stats->values++;
+    if ( v.IsObject() ) {
+        stats->live_bytes += RAPIDJSON_ALIGN(v.MemberCapacity() * sizeof(Value::Member));
+        for ( Value::ConstMemberIterator itr = v.MemberBegin(); itr != v.MemberEnd(); ++itr ) {
+            stats->live_bytes += string_bytes(tree, itr->name);
+            count_live(tree, itr->value, stats);
+        }
+    } else if ( v.IsArray() ) {
+        stats->live_bytes += RAPIDJSON_ALIGN(v.Capacity() * sizeof(Value));
+        for ( Value::ConstValueIterator e = v.Begin(); e != v.End(); ++e ) {
+            count_live(tree, *e, stats);
+        }
+    } else if ( v.IsString() ) {
+        stats->live_bytes += string_bytes(tree, v);
+    }
+}
+
+static void count_allocators(PropertyTree *tree, PropertyMemoryStats *stats) {
+    stats->allocator_bytes = tree->doc->GetAllocator().Size();
+    stats->allocator_capacity = tree->doc->GetAllocator().Capacity();
+#if !defined(ARDUPILOT_BUILD)
+    // merged include values still live in their parse allocators
+    vector<MemoryPoolAllocator<> *> &include = tree->state->include_allocators;
+    for ( unsigned int i = 0; i < include.size(); i++ ) {
+        stats->allocator_bytes += include[i]->Size();
+        stats->allocator_capacity += include[i]->Capacity();
+    }
+#endif
+}
+
+PropertyMemoryStats PropertyTree::getMemoryStats() {
+    PropertyLock lock(this, nullptr, PROPS2_LOCK_STRUCTURE);
+    PropertyMemoryStats stats;
+    count_live(this, *doc, &stats);
+    count_allocators(this, &stats);
+    return stats;
+}
+
+PropertyMemoryStats PropertyNode::getMemoryStats() {
+    PropertyMemoryStats stats;
+    if ( tree == nullptr ) {
+        return stats;           // snapshot nodes
+    }
+    PropertyLock lock(tree, nullptr, PROPS2_LOCK_STRUCTURE);
+    if ( !valid() ) {
+        return stats;
+    }
+    count_live(tree, *val, &stats);
+    count_allocators(tree, &stats);
+    return stats;
+}
+
+// Compaction: the tree is rebuilt by a deep copy that reserves every
+// object and array at its exact size (a plain CopyFrom() regrows them
+// member by member and leaks the smaller blocks), so the new allocator
+// holds just the live values.  All strings are copied, in situ text
+// included, so nothing points back into the old allocator.  The member
+// indices are keyed on member storage addresses, which could come up
+// again, so they are dropped and rebuilt on demand; path records
+// re-resolve after the generation bump.
+static void copy_compact(Value &dst, const Value &src,
+                         MemoryPoolAllocator<> &allocator)
+{
+    if ( src.IsObject() ) {
+        dst.SetObject();
+        dst.MemberReserve(src.MemberCount(), allocator);
+        for ( Value::ConstMemberIterator itr = src.MemberBegin(); itr != src.MemberEnd(); ++itr ) {
+            Value name(itr->name.GetString(), itr->name.GetStringLength(),
+                       allocator);
+            Value v;
+            copy_compact(v, itr->value, allocator);
+            dst.AddMember(name, v, allocator);
+        }
+    } else if ( src.IsArray() ) {
+        dst.SetArray();
+        dst.Reserve(src.Size(), allocator);
+        for ( Value::ConstValueIterator e = src.Begin(); e != src.End(); ++e ) {
+            Value v;
+            copy_compact(v, *e, allocator);
+            dst.PushBack(v, allocator);
+        }
+    } else if ( src.IsString() ) {
+        dst.SetString(src.GetString(), src.GetStringLength(), allocator);
+    } else {
+        dst.CopyFrom(src, allocator);
+    }
+}
+
+bool PropertyTree::compact() {
+    PropertyLock lock(this, nullptr, PROPS2_LOCK_STRUCTURE);
+    if ( refuse_allocation(this, "compact") ) {
+        return false;
+    }
+    if ( state->arena_allocator != nullptr ) {
+        // park a copy on the heap while the arena is reset
+        Document parked;
+        copy_compact(parked, *doc, parked.GetAllocator());
+        doc->SetNull();
+        state->arena_allocator->Clear();
+        copy_compact(*doc, parked, doc->GetAllocator());
+    } else {
+        Document fresh;
+        copy_compact(fresh, *doc, fresh.GetAllocator());
+        doc->Swap(fresh);       // the old allocator goes with fresh
+    }
+#if !defined(ARDUPILOT_BUILD)
+    for ( unsigned int i = 0; i < state->include_allocators.size(); i++ ) {
+        delete state->include_allocators[i];
+    }
+    state->include_allocators.clear();
+#endif
+    state->member_indices.clear();
+    state->string_buffers.clear();
+    structure_changed(this);
+    return true;
+}
+
+// find element [index] of array member name (nullptr and a warning if
+// it doesn't exist), elements of packed arrays are copied to scratch
+static Value *find_element( PropertyTree *tree, Value *node, const char *name,
+                            int index, Value &scratch )
+{
+    if ( !node->IsObject() ) {
+        PROPS2_WARN("v is not an object\n");
+        return nullptr;
+    }
+    Value *v = find_member(tree, node, name);
+    if ( v == nullptr ) {
+        PROPS2_WARN("no member in %s[%d]\n", name, index);
+        return nullptr;
+    }
+    bool packed = is_packed(*v);
+    if ( !v->IsArray() and !packed ) {
+        PROPS2_WARN("not an array: %s\n", name);
+        return nullptr;
+    }
+    int size = packed ? packed_count(*v) : v->Size();
+    if ( index < 0 or index >= size ) {
+        PROPS2_WARN("index out of bounds: %s[%d]\n", name, index);
+        return nullptr;
+    }
+    if ( packed ) {
+        if ( packed_type(*v) == PACKED_INT ) {
+            scratch.SetInt(packed_get<int>(*v, index));
         } else {
-            return (string)name + ": not a member";
+            scratch.SetDouble(packed_get<double>(*v, index));
         }
+        return &scratch;
     }
-    return (string)name + ": not an object";
+    return &(*v)[index];
+}
+
+bool PropertyNode::getBool( const char *name, int index ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return false;
+    }
+    Value scratch;
+    Value *v = find_element(tree, val, name, index, scratch);
+    if ( v != nullptr ) {
+        return getValueAsBool(*v);
+    }
+    return false;
+}
+
+int PropertyNode::getInt( const char *name, int index ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0;
+    }
+    Value scratch;
+    Value *v = find_element(tree, val, name, index, scratch);
+    if ( v != nullptr ) {
+        return getValueAsInt(*v);
+    }
+    return 0;
+}
+
+unsigned int PropertyNode::getUInt( const char *name, int index ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0;
+    }
+    Value scratch;
+    Value *v = find_element(tree, val, name, index, scratch);
+    if ( v != nullptr ) {
+        return getValueAsUInt(*v);
+    }
+    return 0;
 }
 
 float PropertyNode::getFloat( const char *name, int index ) {
-    if ( val->IsObject() ) {
-        if ( val->HasMember(name) ) {
-            Value &v = (*val)[name];
-            if ( v.IsArray() ) {
-                if ( index >= 0 and index < v.Size() ) {
-                    return getValueAsFloat(v[index]);
-                } else {
-                    printf("index out of bounds: %s\n", name);
-                }
-            } else {
-                printf("not an array: %s\n", name);
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0.0;
+    }
+    Value scratch;
+    Value *v = find_element(tree, val, name, index, scratch);
+    if ( v != nullptr ) {
+        return getValueAsFloat(*v);
+    }
+    return 0.0;
+}
+
+double PropertyNode::getDouble( const char *name, int index ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0.0;
+    }
+    Value scratch;
+    Value *v = find_element(tree, val, name, index, scratch);
+    if ( v != nullptr ) {
+        return getValueAsDouble(*v);
+    }
+    return 0.0;
+}
+
+string PropertyNode::getString( const char *name, int index ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return "";
+    }
+    Value scratch;
+    Value *v = find_element(tree, val, name, index, scratch);
+    if ( v != nullptr ) {
+        return getValueAsString(*v);
+    }
+    return "";
+}
+
+// bulk array copies: resolve the member once, then copy in a tight
+// loop.  Returns the number of elements copied (the smaller of the
+// array size and count.)
+template <typename T>
+static int get_array( PropertyTree *tree, Value *node, const char *name,
+                      T *dst, int count, T (*convert)(Value &) )
+{
+    if ( !node->IsObject() ) {
+        return 0;
+    }
+    Value *a = find_member(tree, node, name);
+    if ( a != nullptr and is_packed(*a) ) {
+        int n = packed_count(*a);
+        if ( count < n ) {
+            n = count;
+        }
+        packed_read(*a, dst, n);
+        return n;
+    }
+    if ( a == nullptr or !a->IsArray() ) {
+        PROPS2_WARN("not an array: %s\n", name);
+        return 0;
+    }
+    int n = a->Size();
+    if ( count < n ) {
+        n = count;
+    }
+    Value *elements = a->Begin();
+    for ( int i = 0; i < n; i++ ) {
+        dst[i] = convert(elements[i]);
+    }
+    return n;
+}
+
+static double value_as_double( Value &v ) {
+    return v.IsDouble() ? v.GetDouble() : getValueAsDouble(v);
+}
+
+static float value_as_float( Value &v ) {
+    return v.IsDouble() ? (float)v.GetDouble() : getValueAsFloat(v);
+}
+
+static int value_as_int( Value &v ) {
+    return v.IsInt() ? v.GetInt() : getValueAsInt(v);
+}
+
+int PropertyNode::getDoubleArray( const char *name, double *dst, int count ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0;
+    }
+    return get_array(tree, val, name, dst, count, value_as_double);
+}
+
+int PropertyNode::getFloatArray( const char *name, float *dst, int count ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0;
+    }
+    return get_array(tree, val, name, dst, count, value_as_float);
+}
+
+int PropertyNode::getIntArray( const char *name, int *dst, int count ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() ) {
+        return 0;
+    }
+    return get_array(tree, val, name, dst, count, value_as_int);
+}
+
+static inline char packed_type_of( const double * ) { return PACKED_DOUBLE; }
+static inline char packed_type_of( const float * ) { return PACKED_DOUBLE; }
+static inline char packed_type_of( const int * ) { return PACKED_INT; }
+
+static inline void store( Value &v, double x ) { v.SetDouble(x); }
+static inline void store( Value &v, float x ) { v.SetFloat(x); }
+static inline void store( Value &v, int x ) { v.SetInt(x); }
+
+// size array member name to exactly count elements (creating or
+// converting it as needed) with a single reservation, and copy src in.
+// A packed member stays packed (re-typed to match src if needed.)
+template <typename T>
+static bool set_array( PropertyTree *tree, Value *node, const char *name,
+                       const T *src, int count )
+{
+    if ( count < 0 ) {
+        return false;
+    }
+    if ( !node->IsObject() ) {
+        check_replace(tree, node);
+        node->SetObject();
+    }
+    Value *a = find_member(tree, node, name);
+    if ( a == nullptr ) {
+        PROPS2_DEBUG("creating %s\n", name);
+        Value newval(kArrayType);
+        a = add_member(tree, node, name, newval);
+        if ( a == nullptr ) {
+            return false;
+        }
+    } else if ( is_packed(*a) ) {
+        char type = packed_type_of(src);
+        if ( packed_type(*a) != type or packed_count(*a) != count ) {
+            if ( refuse_allocation(tree, "resize array") ) {
+                return false;
             }
+            make_packed(*a, type, count, tree->doc->GetAllocator());
+        }
+        if ( packed_element_size(type) == sizeof(T) ) {
+            memcpy(packed_data(*a), src, count * sizeof(T));
         } else {
-            printf("no member in getFloat(%s, %d)\n", name, index);
+            for ( int i = 0; i < count; i++ ) {
+                packed_set(*a, i, src[i]);
+            }
         }
-    } else {
-        printf("v is not an object\n");
+        return true;
+    } else if ( !a->IsArray() ) {
+        PROPS2_INFO("converting member to array: %s\n", name);
+        check_replace(tree, a);
+        a->SetArray();
     }
-    return 0.0;
+    int size = a->Size();
+    if ( size != count ) {
+        if ( (int)a->Capacity() < count ) {
+            if ( refuse_allocation(tree, "resize array") ) {
+                return false;
+            }
+            a->Reserve(count, tree->doc->GetAllocator());
+        }
+        while ( size > count ) {
+            a->PopBack();
+            size--;
+        }
+        structure_changed(tree);
+    }
+    Value *elements = a->Begin();
+    for ( int i = 0; i < size; i++ ) {
+        check_replace(tree, &elements[i]);
+        store(elements[i], src[i]);
+    }
+    for ( int i = size; i < count; i++ ) {
+        Value v(src[i]);
+        a->PushBack(v, tree->doc->GetAllocator());
+    }
+    return true;
+}
+
+// store src into an existing array member of the same length (or a
+// packed one of the same type and length) in place, false if
+// set_array() is needed to create, resize or convert it
+template <typename T>
+static bool store_array( PropertyTree *tree, Value *node, const char *name,
+                         const T *src, int count )
+{
+    if ( !node->IsObject() ) {
+        return false;
+    }
+    Value *a = find_member(tree, node, name);
+    if ( a == nullptr ) {
+        return false;
+    }
+    if ( is_packed(*a) ) {
+        if ( packed_type(*a) != packed_type_of(src) or packed_count(*a) != count ) {
+            return false;
+        }
+        memcpy(packed_data(*a), src, count * sizeof(T));
+        return true;
+    }
+    if ( !a->IsArray() or (int)a->Size() != count ) {
+        return false;
+    }
+    Value *elements = a->Begin();
+    for ( int i = 0; i < count; i++ ) {
+        if ( elements[i].IsObject() or elements[i].IsArray() ) {
+            return false;
+        }
+    }
+    for ( int i = 0; i < count; i++ ) {
+        store(elements[i], src[i]);
+    }
+    return true;
+}
+
+bool PropertyNode::setDoubleArray( const char *name, const double *src, int count ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
+    if ( !store_array(tree, val, name, src, count) ) {
+        lock.escalate();
+        if ( !valid() or !set_array(tree, val, name, src, count) ) {
+            return false;
+        }
+    }
+    touch_member(tree, rec, name);
+    return true;
+}
+
+bool PropertyNode::setFloatArray( const char *name, const float *src, int count ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
+    if ( !store_array(tree, val, name, src, count) ) {
+        lock.escalate();
+        if ( !valid() or !set_array(tree, val, name, src, count) ) {
+            return false;
+        }
+    }
+    touch_member(tree, rec, name);
+    return true;
+}
+
+bool PropertyNode::setIntArray( const char *name, const int *src, int count ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
+    if ( !store_array(tree, val, name, src, count) ) {
+        lock.escalate();
+        if ( !valid() or !set_array(tree, val, name, src, count) ) {
+            return false;
+        }
+    }
+    touch_member(tree, rec, name);
+    return true;
+}
+
+bool PropertyNode::isPacked( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ);
+    if ( !valid() or !val->IsObject() ) {
+        return false;
+    }
+    Value *v = find_member(tree, val, name);
+    return v != nullptr and is_packed(*v);
+}
+
+bool PropertyNode::packArray( const char *name ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() or !val->IsObject() ) {
+        return false;
+    }
+    Value *v = find_member(tree, val, name);
+    if ( v == nullptr ) {
+        return false;
+    }
+    if ( is_packed(*v) ) {
+        return true;
+    }
+    if ( refuse_allocation(tree, "pack array") ) {
+        return false;
+    }
+    if ( !pack_array(*v, tree->doc->GetAllocator()) ) {
+        PROPS2_WARN("not a numeric array: %s\n", name);
+        return false;
+    }
+    structure_changed(tree);        // the elements are gone
+    return true;
+}
+
+// store into an existing scalar member in place, false if the member
+// must be created or replaces a container (a structural change)
+template <typename T>
+static bool set_scalar( PropertyTree *tree, Value *node, const char *name, T x ) {
+    if ( !node->IsObject() ) {
+        return false;
+    }
+    Value *v = find_member(tree, node, name);
+    if ( v == nullptr or v->IsObject() or v->IsArray() ) {
+        return false;
+    }
+    *v = x;
+    return true;
 }
 
 bool PropertyNode::setBool( const char *name, bool b ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
+    if ( set_scalar(tree, val, name, b) ) {
+        touch_member(tree, rec, name);
+        return true;
+    }
+    lock.escalate();
+    if ( !valid() ) {
+        return false;
+    }
     if ( !val->IsObject() ) {
+        check_replace(tree, val);
         val->SetObject();
     }
-    Value newval(b);
-    if ( !val->HasMember(name) ) {
-        printf("creating %s\n", name);
-        Value key(name, doc.GetAllocator());
-        val->AddMember(key, newval, doc.GetAllocator());
+    Value *v = find_member(tree, val, name);
+    if ( v == nullptr ) {
+        PROPS2_DEBUG("creating %s\n", name);
+        Value newval(b);
+        if ( add_member(tree, val, name, newval) == nullptr ) {
+            return false;
+        }
     } else {
         // printf("%s already exists\n", name);
+        check_replace(tree, v);
+        *v = b;
     }
-    (*val)[name] = b;
+    touch_member(tree, rec, name);
     return true;
 }
 
 bool PropertyNode::setInt( const char *name, int n ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
+    if ( set_scalar(tree, val, name, n) ) {
+        touch_member(tree, rec, name);
+        return true;
+    }
+    lock.escalate();
+    if ( !valid() ) {
+        return false;
+    }
     if ( !val->IsObject() ) {
+        check_replace(tree, val);
         val->SetObject();
     }
-    Value newval(n);
-    if ( !val->HasMember(name) ) {
-        printf("creating %s\n", name);
-        Value key(name, doc.GetAllocator());
-        val->AddMember(key, newval, doc.GetAllocator());
+    Value *v = find_member(tree, val, name);
+    if ( v == nullptr ) {
+        PROPS2_DEBUG("creating %s\n", name);
+        Value newval(n);
+        if ( add_member(tree, val, name, newval) == nullptr ) {
+            return false;
+        }
     } else {
         // printf("%s already exists\n", name);
+        check_replace(tree, v);
+        *v = n;
     }
-    (*val)[name] = n;
+    touch_member(tree, rec, name);
     return true;
 }
 
 bool PropertyNode::setUInt( const char *name, unsigned int u ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
+    if ( set_scalar(tree, val, name, u) ) {
+        touch_member(tree, rec, name);
+        return true;
+    }
+    lock.escalate();
+    if ( !valid() ) {
+        return false;
+    }
     if ( !val->IsObject() ) {
+        check_replace(tree, val);
         val->SetObject();
     }
-    Value newval(u);
-    if ( !val->HasMember(name) ) {
-        printf("creating %s\n", name);
-        Value key(name, doc.GetAllocator());
-        val->AddMember(key, newval, doc.GetAllocator());
+    Value *v = find_member(tree, val, name);
+    if ( v == nullptr ) {
+        PROPS2_DEBUG("creating %s\n", name);
+        Value newval(u);
+        if ( add_member(tree, val, name, newval) == nullptr ) {
+            return false;
+        }
     } else {
         // printf("%s already exists\n", name);
+        check_replace(tree, v);
+        *v = u;
     }
-    (*val)[name] = u;
+    touch_member(tree, rec, name);
     return true;
 }
 
 bool PropertyNode::setFloat( const char *name, float x ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
+    if ( set_scalar(tree, val, name, x) ) {
+        touch_member(tree, rec, name);
+        return true;
+    }
+    lock.escalate();
+    if ( !valid() ) {
+        return false;
+    }
     //printf("setFloat(%s) = %f\n", name, val);
     // hal.scheduler->delay(100);
     if ( !val->IsObject() ) {
-        printf("  converting value to object\n");
+        PROPS2_DEBUG("  converting value to object\n");
         // hal.scheduler->delay(100);
+        check_replace(tree, val);
         val->SetObject();
     }
     // printf("  creating newval\n");
     // hal.scheduler->delay(100);
-    Value newval(x);
-    if ( !val->HasMember(name) ) {
-        printf("creating %s\n", name);
-        Value key(name, doc.GetAllocator());
-        val->AddMember(key, newval, doc.GetAllocator());
+    Value *v = find_member(tree, val, name);
+    if ( v == nullptr ) {
+        PROPS2_DEBUG("creating %s\n", name);
+        Value newval(x);
+        if ( add_member(tree, val, name, newval) == nullptr ) {
+            return false;
+        }
     } else {
         // printf("%s already exists\n", name);
+        check_replace(tree, v);
+        *v = x;
     }
-    (*val)[name] = x;
     // hal.scheduler->delay(100);
+    touch_member(tree, rec, name);
     return true;
 }
 
 bool PropertyNode::setDouble( const char *name, double x ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
+    if ( set_scalar(tree, val, name, x) ) {
+        touch_member(tree, rec, name);
+        return true;
+    }
+    lock.escalate();
+    if ( !valid() ) {
+        return false;
+    }
     if ( !val->IsObject() ) {
+        check_replace(tree, val);
         val->SetObject();
     }
-    Value newval(x);
-    if ( !val->HasMember(name) ) {
-        printf("creating %s\n", name);
-        Value key(name, doc.GetAllocator());
-        val->AddMember(key, newval, doc.GetAllocator());
+    Value *v = find_member(tree, val, name);
+    if ( v == nullptr ) {
+        PROPS2_DEBUG("creating %s\n", name);
+        Value newval(x);
+        if ( add_member(tree, val, name, newval) == nullptr ) {
+            return false;
+        }
     } else {
         // printf("%s already exists\n", name);
+        check_replace(tree, v);
+        *v = x;
+    }
+    touch_member(tree, rec, name);
+    return true;
+}
+
+// String leaves: short strings are stored inside the Value by rapidjson
+// (no allocation.)  Longer ones get a buffer of their own with some
+// slack, remembered in the tree's string_buffers, and later strings
+// that fit are written over it in place, so a status string updated
+// every frame allocates once.  The Value refers to the buffer as a
+// const string (copies such as snapshots copy const strings.)  The pool
+// never hands an address out twice, so a buffer abandoned by replacing
+// the value can't be mistaken for a later one (compact() clears them.)
+static const SizeType string_buffer_min = 32;
+
+static SizeType string_capacity(PropertyTree *tree, const Value &v) {
+    StringBufferMap::iterator itr = tree->state->string_buffers.find(v.GetString());
+    return itr != tree->state->string_buffers.end() ? itr->second : 0;
+}
+
+static bool set_string( PropertyTree *tree, Value *v, const char *s,
+                        SizeType len )
+{
+    if ( v->IsString() and string_capacity(tree, *v) > len ) {
+        char *buf = (char *)v->GetString();
+        memmove(buf, s, len);
+        buf[len] = 0;
+        v->SetString(StringRef(buf, len));
+        return true;
+    }
+    if ( len <= inline_string_max ) {
+        v->SetString(s, len, tree->doc->GetAllocator());
+        return true;
+    }
+    if ( refuse_allocation(tree, "copy string") ) {
+        return false;
+    }
+    SizeType cap = len + 1 + len / 2;
+    if ( cap < string_buffer_min ) {
+        cap = string_buffer_min;
+    }
+    cap = RAPIDJSON_ALIGN(cap);
+    char *buf = (char *)tree->doc->GetAllocator().Malloc(cap);
+    if ( buf == nullptr ) {
+        PROPS2_ERROR("no memory for a %d byte string\n", (int)len);
+        return false;
     }
-    (*val)[name] = x;
+    memcpy(buf, s, len);
+    buf[len] = 0;
+    v->SetString(StringRef(buf, len));
+    tree->state->string_buffers[buf] = cap;
     return true;
 }
 
-bool PropertyNode::setString( const char *name, string s ) {
+bool PropertyNode::store_string( const char *name, const char *s,
+                                 SizeType len )
+{
+    if ( is_packed(Value(StringRef(s, len))) ) {
+        PROPS2_ERROR("string reads as packed array storage: %s\n", name);
+        return false;
+    }
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
     if ( !val->IsObject() ) {
+        check_replace(tree, val);
         val->SetObject();
     }
-    if ( !val->HasMember(name) ) {
+    Value *v = find_member(tree, val, name);
+    if ( v == nullptr ) {
         Value newval("");
-        printf("creating %s\n", name);
-        Value key(name, doc.GetAllocator());
-        val->AddMember(key, newval, doc.GetAllocator());
+        PROPS2_DEBUG("creating %s\n", name);
+        v = add_member(tree, val, name, newval);
+        if ( v == nullptr ) {
+            return false;
+        }
     } else {
         // printf("%s already exists\n", name);
     }
-    (*val)[name].SetString(s.c_str(), s.length());
+    check_replace(tree, v);
+    if ( !set_string(tree, v, s, len) ) {
+        return false;
+    }
+    touch_member(tree, rec, name);
+    return true;
+}
+
+bool PropertyNode::setString( const char *name, const char *s ) {
+    return store_string(name, s, strlen(s));
+}
+
+bool PropertyNode::setString( const char *name, const string &s ) {
+    return store_string(name, s.data(), s.length());
+}
+
+// store into an existing element of array member name in place, false
+// if the array must be created, extended or converted
+static bool set_element( PropertyTree *tree, Value *node, const char *name,
+                         int index, float x )
+{
+    if ( !node->IsObject() or index < 0 ) {
+        return false;
+    }
+    Value *a = find_member(tree, node, name);
+    if ( a == nullptr ) {
+        return false;
+    }
+    if ( is_packed(*a) ) {
+        if ( index >= packed_count(*a) ) {
+            return false;
+        }
+        packed_set(*a, index, x);
+        return true;
+    }
+    if ( !a->IsArray() or index >= (int)a->Size() ) {
+        return false;
+    }
+    Value &e = (*a)[index];
+    if ( e.IsObject() or e.IsArray() ) {
+        return false;
+    }
+    e = x;
     return true;
 }
 
 bool PropertyNode::setFloat( const char *name, int index, float x ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE);
+    if ( read_only or !valid() ) {
+        return false;
+    }
+    if ( set_element(tree, val, name, index, x) ) {
+        touch_member(tree, rec, name);
+        return true;
+    }
+    lock.escalate();
+    if ( !valid() ) {
+        return false;
+    }
     if ( !val->IsObject() ) {
-        printf("  converting value to object\n");
+        PROPS2_DEBUG("  converting value to object\n");
         // hal.scheduler->delay(100);
+        check_replace(tree, val);
         val->SetObject();
     }
-    if ( !val->HasMember(name) ) {
-        printf("creating %s\n", name);
-        Value key(name, doc.GetAllocator());
-        Value a(kArrayType);
-        val->AddMember(key, a, doc.GetAllocator());
+    Value *a = find_member(tree, val, name);
+    if ( a == nullptr ) {
+        PROPS2_DEBUG("creating %s\n", name);
+        Value newval(kArrayType);
+        a = add_member(tree, val, name, newval);
+        if ( a == nullptr ) {
+            return false;
+        }
+    } else if ( is_packed(*a) and index >= 0 and index < packed_count(*a) ) {
+        packed_set(*a, index, x);
+        touch_member(tree, rec, name);
+        return true;
     } else {
         // printf("%s already exists\n", name);
-        Value &a = (*val)[name];
-        if ( ! a.IsArray() ) {
-            printf("converting member to array: %s\n", name);
-            a.SetArray();
+        if ( is_packed(*a) ) {
+            if ( refuse_allocation(tree, "unpack array") ) {
+                return false;
+            }
+            unpack_array(*a, tree->doc->GetAllocator());
+        } else if ( ! a->IsArray() ) {
+            PROPS2_INFO("converting member to array: %s\n", name);
+            check_replace(tree, a);
+            a->SetArray();
         }
     }
-    Value &a = (*val)[name];
-    extend_array(&a, index);    // protect against out of range
-    a[index] = x;
+    // protect against out of range
+    if ( !extend_array(tree, a, index) ) {
+        return false;
+    }
+    check_replace(tree, &(*a)[index]);
+    (*a)[index] = x;
+    touch_member(tree, rec, name);
     return true;
 }
 
-static bool load_json( const char *file_path, Value *v ) {
-    char read_buf[4096];
-    printf("reading from %s\n", file_path);
-    
+void PropertyTree::setPackedArrays( int min_len ) {
+    state->packed_array_min = min_len;
+}
+
+void PropertyNode::setPackedArrays( int min_len ) {
+    PropertyTree::getDefault()->setPackedArrays(min_len);
+}
+
+// outcome of reading and parsing one json file
+struct ParsedFile {
+    bool ok = false;
+    size_t bytes = 0;
+    char error[160];
+    int read_errno = 0;         // of a failed read, formatted by the
+                                // caller (strerror() isn't thread safe)
+};
+
+static void log_parse_error( const ParsedFile &result ) {
+    if ( result.read_errno != 0 ) {
+        PROPS2_ERROR("%s - %s\n", result.error, strerror(result.read_errno));
+    } else {
+        PROPS2_ERROR("%s\n", result.error);
+    }
+}
+
+// read all of an open file into a nul terminated buffer from allocator
+// (for in situ parsing, so it is never freed)
+static char *read_file( int fd, const char *file_path,
+                        MemoryPoolAllocator<> &allocator, ParsedFile *result )
+{
+    struct stat st;
+    if ( props2_stat(file_path, &st) != 0 ) {
+        snprintf(result->error, sizeof(result->error), "Stat %s failed",
+                 file_path);
+        return nullptr;
+    }
+    char *text = (char *)allocator.Malloc(st.st_size + 1);
+    if ( text == nullptr ) {
+        snprintf(result->error, sizeof(result->error),
+                 "no memory for %s (%ld bytes)", file_path, (long)st.st_size);
+        return nullptr;
+    }
+    size_t len = 0;
+    while ( len < (size_t)st.st_size ) {
+        ssize_t n = props2_read(fd, text + len, st.st_size - len);
+        if ( n < 0 ) {
+            result->read_errno = errno;
+            snprintf(result->error, sizeof(result->error), "Read %s failed",
+                     file_path);
+            return nullptr;
+        }
+        if ( n == 0 ) {
+            break;              // file shrank under us
+        }
+        len += n;
+    }
+    text[len] = 0;
+    result->bytes = len;
+    return text;
+}
+
+// read and parse a json file into d, packing numeric arrays of at
+// least pack_min elements.  Only d's allocator is used and nothing is
+// logged (the outcome is left in result), so this can run on a worker
+// thread with a private allocator.
+static bool parse_file( const char *file_path, unsigned int flags,
+                        int pack_min, Document &d, ParsedFile *result )
+{
+    result->ok = false;
+    result->error[0] = 0;
+
     // open a file in read mode
-#if defined(ARDUPILOT_BUILD)
-    const int open_fd = AP::FS().open(file_path, O_RDONLY);
-#else
-    const int open_fd = open(file_path, O_RDONLY);
-#endif
+    const int open_fd = props2_open(file_path, O_RDONLY);
     if (open_fd == -1) {
-        printf("Open %s failed\n", file_path);
+        snprintf(result->error, sizeof(result->error), "Open %s failed",
+                 file_path);
         return false;
     }
 
-    // read from file
-    ssize_t read_size;
-#if defined(ARDUINO_BUILD)
-    read_size = AP::FS().read(open_fd, read_buf, sizeof(read_buf));
-#else
-    read_size = read(open_fd, read_buf, sizeof(read_buf));
-#endif
-    if ( read_size == -1 ) {
-        printf("Read failed - %s\n", strerror(errno));
-        return false;
-    }
+    if ( flags & PROPS2_LOAD_INSITU ) {
+        char *text = read_file(open_fd, file_path, d.GetAllocator(), result);
+        props2_close(open_fd);
+        if ( text == nullptr ) {
+            return false;
+        }
+        d.ParseInsitu(text);
+    } else {
+        // straight from the file through a small buffer (any file size)
+        char read_buf[4096];
+        FdReadStream is(open_fd, read_buf, sizeof(read_buf));
+        d.ParseStream(is);
+        int read_errno = errno;
 
-    // close file after reading
-#if defined(ARDUINO_BUILD)
-    AP::FS().close(open_fd);
-#else
-    close(open_fd);
-#endif
+        // close file after reading
+        props2_close(open_fd);
 
-    if ( read_size >= 0 ) {
-        read_buf[read_size] = 0; // null terminate
+        if ( is.error() ) {
+            result->read_errno = read_errno;
+            snprintf(result->error, sizeof(result->error), "Read %s failed",
+                     file_path);
+            return false;
+        }
+        result->bytes = is.Tell();
     }
-    printf("Read %d bytes.\n", read_size);
-    // printf("Read %d bytes.\nstring: %s\n", read_size, read_buf);
-    // hal.scheduler->delay(100);
-
-    Document tmpdoc(&doc.GetAllocator());
-    tmpdoc.Parse(read_buf);
-    if ( tmpdoc.HasParseError() ){
-        printf("json parse err: %d (%s)\n",
-               tmpdoc.GetParseError(),
-               GetParseError_En(tmpdoc.GetParseError()));
+    if ( d.HasParseError() ){
+        snprintf(result->error, sizeof(result->error),
+                 "json parse err: %d (%s)", d.GetParseError(),
+                 GetParseError_En(d.GetParseError()));
+        return false;
+    }
+    if ( !d.IsObject() ) {
+        snprintf(result->error, sizeof(result->error),
+                 "%s: top level json value is not an object", file_path);
         return false;
     }
+    if ( contains_packed(d) ) {
+        snprintf(result->error, sizeof(result->error),
+                 "%s: a string value reads as packed array storage", file_path);
+        return false;
+    }
+    if ( pack_min > 0 ) {
+        pack_arrays(d, pack_min, d.GetAllocator());
+    }
+    result->ok = true;
+    return true;
+}
+
+// merge each top level member of a parsed file individually (moved, not
+// copied)
+static void merge_file( PropertyTree *tree, Value *v, Document &d ) {
+    for (Value::MemberIterator itr = d.MemberBegin(); itr != d.MemberEnd(); ++itr) {
+        PROPS2_DEBUG(" merging: %s\n", itr->name.GetString());
+        add_member(tree, v, itr->name, itr->value);
+    }
+}
 
-    // merge each new top level member individually
-    for (Value::ConstMemberIterator itr = tmpdoc.MemberBegin(); itr != tmpdoc.MemberEnd(); ++itr) {
-        printf(" merging: %s\n", itr->name.GetString());
-        Value key;
-        key.SetString(itr->name.GetString(), itr->name.GetStringLength(), doc.GetAllocator());
-        Value &newval = tmpdoc[itr->name.GetString()];
-        v->AddMember(key, newval, doc.GetAllocator());
+// files read by the current load (the binary cache key)
+struct LoadTrace {
+    vector<string> files;
+    bool failed = false;
+};
+
+static void trace_file( PropertyTree *tree, const char *file_path, bool ok ) {
+    LoadTrace *load_trace = tree->state->load_trace;
+    if ( load_trace != nullptr ) {
+        if ( ok ) {
+            load_trace->files.push_back(file_path);
+        } else {
+            load_trace->failed = true;
+        }
     }
+}
 
+static bool load_json( PropertyTree *tree, const char *file_path, Value *v,
+                       unsigned int flags )
+{
+    PROPS2_INFO("reading from %s\n", file_path);
+
+    // parse into a document sharing the tree allocator so the members
+    // can be moved across without a second copy
+    Document tmpdoc(&tree->doc->GetAllocator());
+    ParsedFile result;
+    bool ok = parse_file(file_path, flags, tree->state->packed_array_min,
+                         tmpdoc, &result);
+    trace_file(tree, file_path, ok);
+    if ( !ok ) {
+        log_parse_error(result);
+        return false;
+    }
+    PROPS2_DEBUG("Read %d bytes.\n", (int)result.bytes);
+    merge_file(tree, v, tmpdoc);
     return true;
 }
 
 // fixme: currently no mechanism to override include values
-static void recursively_expand_includes(Value *v) {
+static void recursively_expand_includes(PropertyTree *tree, Value *v,
+                                        unsigned int flags)
+{
+    if ( v->IsObject() ) {
+        Value *include = find_member(tree, v, "include");
+        if ( include != nullptr and include->IsString() ) {
+            PROPS2_INFO("Need to include: %s\n", include->GetString());
+            load_json( tree, include->GetString(), v, flags );
+            remove_member(tree, v, "include");
+        } else {
+            for (Value::MemberIterator itr = v->MemberBegin(); itr != v->MemberEnd(); ++itr) {
+                if ( itr->value.IsObject() ) {
+                    recursively_expand_includes( tree, &itr->value, flags );
+                }
+            }
+        }
+    }
+}
+
+#if !defined(ARDUPILOT_BUILD)
+
+// Parallel include expansion: the include files are read and parsed
+// concurrently on a few worker threads, each into its own document and
+// allocator, then merged on the calling thread in the same order a
+// serial load would use.  The worker allocators back the merged values
+// so they are kept for the life of the tree (in its state.)
+struct IncludeJob {
+    Value *target;              // object holding the "include"
+    const char *path;
+    Document *doc;
+    ParsedFile result;
+};
+
+static const unsigned int min_include_threads = 4;
+static const unsigned int max_include_threads = 8;
+
+// same traversal as recursively_expand_includes() (included content is
+// not searched for further includes)
+static void collect_includes(PropertyTree *tree, Value *v,
+                             vector<IncludeJob> &jobs)
+{
     if ( v->IsObject() ) {
-        if ( v->HasMember("include") and (*v)["include"].IsString() ) {
-            printf("Need to include: %s\n", (*v)["include"].GetString());
-            load_json( (*v)["include"].GetString(), v );
-            v->RemoveMember("include");
+        Value *include = find_member(tree, v, "include");
+        if ( include != nullptr and include->IsString() ) {
+            IncludeJob job;
+            job.target = v;
+            job.path = include->GetString();
+            job.doc = nullptr;
+            jobs.push_back(job);
         } else {
             for (Value::MemberIterator itr = v->MemberBegin(); itr != v->MemberEnd(); ++itr) {
                 if ( itr->value.IsObject() ) {
-                    recursively_expand_includes( &itr->value );
+                    collect_includes( tree, &itr->value, jobs );
                 }
             }
         }
     }
 }
 
-bool PropertyNode::load( const char *file_path ) {
-    if ( !load_json(file_path, val) ) {
+static void parallel_expand_includes(PropertyTree *tree, Value *v,
+                                     unsigned int flags)
+{
+    vector<IncludeJob> jobs;
+    collect_includes(tree, v, jobs);
+    if ( jobs.empty() ) {
+        return;
+    }
+    for ( unsigned int i = 0; i < jobs.size(); i++ ) {
+        MemoryPoolAllocator<> *allocator = new MemoryPoolAllocator<>();
+        tree->state->include_allocators.push_back(allocator);
+        jobs[i].doc = new Document(allocator);
+    }
+
+    std::atomic<unsigned int> next(0);
+    int pack_min = tree->state->packed_array_min;
+    auto worker = [&jobs, &next, flags, pack_min]() {
+        unsigned int i;
+        while ( (i = next++) < jobs.size() ) {
+            parse_file(jobs[i].path, flags, pack_min, *jobs[i].doc,
+                       &jobs[i].result);
+        }
+    };
+    // file reads wait on i/o, so overlap a few even on a small cpu
+    unsigned int nthreads = std::thread::hardware_concurrency();
+    if ( nthreads < min_include_threads ) {
+        nthreads = min_include_threads;
+    }
+    if ( nthreads > max_include_threads ) {
+        nthreads = max_include_threads;
+    }
+    if ( nthreads > jobs.size() ) {
+        nthreads = jobs.size();
+    }
+    vector<std::thread> threads;
+    for ( unsigned int i = 1; i < nthreads; i++ ) {
+        threads.push_back(std::thread(worker));
+    }
+    worker();                   // this thread works too
+    for ( unsigned int i = 0; i < threads.size(); i++ ) {
+        threads[i].join();
+    }
+
+    // deterministic merge (targets are never nested in each other, so
+    // merging into one doesn't move another)
+    for ( unsigned int i = 0; i < jobs.size(); i++ ) {
+        IncludeJob &job = jobs[i];
+        PROPS2_INFO("Need to include: %s\n", job.path);
+        trace_file(tree, job.path, job.result.ok);
+        if ( job.result.ok ) {
+            PROPS2_DEBUG("Read %d bytes.\n", (int)job.result.bytes);
+            merge_file(tree, job.target, *job.doc);
+        } else {
+            log_parse_error(job.result);
+        }
+        remove_member(tree, job.target, "include");
+        delete job.doc;
+    }
+}
+
+#endif
+
+static void expand_includes(PropertyTree *tree, Value *v, unsigned int flags) {
+#if !defined(ARDUPILOT_BUILD)
+    // (serial in an arena tree so everything lands in the arena)
+    if ( (flags & PROPS2_LOAD_PARALLEL_INCLUDES) and tree->state->arena == nullptr ) {
+        parallel_expand_includes(tree, v, flags);
+        return;
+    }
+#endif
+    recursively_expand_includes(tree, v, flags);
+}
+
+// read a whole (binary) file into out
+static bool read_image( const char *path, string &out ) {
+    struct stat st;
+    if ( props2_stat(path, &st) != 0 ) {
+        return false;
+    }
+    const int fd = props2_open(path, O_RDONLY);
+    if ( fd == -1 ) {
+        return false;
+    }
+    out.resize(st.st_size);
+    size_t got = 0;
+    while ( got < out.length() ) {
+        ssize_t n = props2_read(fd, &out[got], out.length() - got);
+        if ( n <= 0 ) {
+            break;
+        }
+        got += n;
+    }
+    props2_close(fd);
+    return got == out.length();
+}
+
+// replace path with what write(fd) puts in a file beside it, synced
+// and renamed over so a reader (or a power loss) never sees a partial
+// file.  write returns false on failure.
+template <typename F>
+static bool replace_file( const char *path, F write ) {
+    string tmp_path = string(path) + ".tmp";
+    const int fd = props2_open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC);
+    if ( fd == -1 ) {
+        return false;
+    }
+    bool ok = write(fd) and props2_fsync(fd) == 0;
+    if ( props2_close(fd) != 0 ) {
+        ok = false;
+    }
+    if ( !ok or props2_rename(tmp_path.c_str(), path) != 0 ) {
+        props2_unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool write_image( const char *path, const string &data ) {
+    return replace_file(path, [&data](int fd) {
+        size_t done = 0;
+        while ( done < data.length() ) {
+            ssize_t n = props2_write(fd, data.data() + done, data.length() - done);
+            if ( n <= 0 ) {
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    });
+}
+
+// Binary config cache: a sidecar file (<config>.cache) holding the
+// include expanded contents of a config in the props2_binary encoding,
+// keyed on the path, mtime and size of the config and every file it
+// included.  The image starts with cache_magic, then the key (an array
+// of [path, mtime, size] arrays), then the tree.
+static const char cache_magic[8] = { 'P', 'R', 'O', 'P', 'S', '2', 'C', '3' };
+
+static bool stat_key( const char *path, int64_t *mtime, int64_t *size ) {
+    struct stat st;
+    if ( props2_stat(path, &st) != 0 ) {
+        return false;
+    }
+    *mtime = st.st_mtime;
+    *size = st.st_size;
+    return true;
+}
+
+// load the cached tree for file_path into tree (strings copied with
+// allocator) if the cache is current
+static bool read_cache( const char *file_path, const char *cache_path,
+                        Value &tree, MemoryPoolAllocator<> &allocator )
+{
+    string buf;
+    if ( !read_image(cache_path, buf) or buf.length() < sizeof(cache_magic)
+         or memcmp(buf.data(), cache_magic, sizeof(cache_magic)) != 0 ) {
+        return false;
+    }
+    const char *image = buf.data();
+    size_t len = buf.length();
+
+    // key: every source must be unchanged (the first is the config)
+    bool current = false;
+    size_t pos = sizeof(cache_magic);
+    Document key;
+    size_t used = binary_decode(image + pos, len - pos, key, key.GetAllocator());
+    if ( used > 0 and key.IsArray() and key.Size() > 0 ) {
+        current = true;
+        for ( SizeType i = 0; current and i < key.Size(); i++ ) {
+            Value &k = key[i];
+            int64_t mtime, size;
+            current = k.IsArray() and k.Size() == 3 and k[0].IsString()
+                and k[1].IsInt64() and k[2].IsInt64()
+                and (i > 0 or strcmp(k[0].GetString(), file_path) == 0)
+                and stat_key(k[0].GetString(), &mtime, &size)
+                and k[1].GetInt64() == mtime and k[2].GetInt64() == size;
+        }
+    }
+    pos += used;
+    if ( current ) {
+        used = binary_decode(image + pos, len - pos, tree, allocator);
+        current = (used > 0 and pos + used == len and tree.IsObject());
+        if ( !current ) {
+            PROPS2_WARN("corrupt config cache: %s\n", cache_path);
+        }
+    }
+    return current;
+}
+
+static void write_cache( const char *cache_path, const vector<string> &files,
+                         const Value &tree )
+{
+    Document key;
+    key.SetArray();
+    for ( unsigned int i = 0; i < files.size(); i++ ) {
+        int64_t mtime, size;
+        if ( !stat_key(files[i].c_str(), &mtime, &size) ) {
+            return;
+        }
+#if !defined(ARDUPILOT_BUILD)
+        // a file modified within the last second could change again
+        // without changing its mtime, don't trust it yet
+        if ( mtime >= (int64_t)time(nullptr) - 1 ) {
+            PROPS2_INFO("%s just changed, not caching\n", files[i].c_str());
+            return;
+        }
+#endif
+        Value k(kArrayType);
+        Value path(files[i].c_str(), files[i].length(), key.GetAllocator());
+        k.PushBack(path, key.GetAllocator());
+        k.PushBack(Value(mtime).Move(), key.GetAllocator());
+        k.PushBack(Value(size).Move(), key.GetAllocator());
+        key.PushBack(k, key.GetAllocator());
+    }
+    string image(cache_magic, sizeof(cache_magic));
+    if ( !binary_encode(key, image) or !binary_encode(tree, image) ) {
+        PROPS2_WARN("config too deeply nested to cache: %s\n", cache_path);
+        return;
+    }
+
+    if ( !write_image(cache_path, image) ) {
+        PROPS2_WARN("failed writing config cache: %s\n", cache_path);
+    }
+}
+
+// load a config through its binary cache (rebuilding a stale cache)
+static bool load_cached( PropertyTree *tree, const char *file_path, Value *v,
+                         unsigned int flags )
+{
+    string cache_path = string(file_path) + ".cache";
+    Value top;
+    if ( read_cache(file_path, cache_path.c_str(), top,
+                    tree->doc->GetAllocator()) ) {
+        PROPS2_INFO("reading %s from cache\n", file_path);
+    } else {
+        LoadTrace trace;
+        tree->state->load_trace = &trace;
+        top.SetObject();
+        bool ok = load_json(tree, file_path, &top, flags);
+        if ( ok ) {
+            expand_includes(tree, &top, flags);
+        }
+        tree->state->load_trace = nullptr;
+        if ( !ok ) {
+            return false;
+        }
+        if ( !trace.failed ) {
+            write_cache(cache_path.c_str(), trace.files, top);
+        }
+    }
+    for (Value::MemberIterator itr = top.MemberBegin(); itr != top.MemberEnd(); ++itr) {
+        add_member(tree, v, itr->name, itr->value);
+    }
+    return true;
+}
+
+bool PropertyNode::load( const char *file_path, unsigned int flags ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() or refuse_allocation(tree, "load") ) {
         return false;
     }
-    recursively_expand_includes(val);
+    if ( flags & PROPS2_LOAD_USE_CACHE ) {
+        if ( !load_cached(tree, file_path, val, flags) ) {
+            return false;
+        }
+    } else {
+        if ( !load_json(tree, file_path, val, flags) ) {
+            return false;
+        }
+        expand_includes(tree, val, flags);
+    }
+    if ( rec != nullptr ) {
+        props2_touch(tree, rec);
+    }
     
-    printf("Updated node contents:\n");
-    pretty_print();
-    printf("\n");
+    if ( PROPS2_LOG_ENABLED(PROPS2_LOG_DEBUG) ) {
+        printf("Updated node contents:\n");
+        pretty_print();
+        printf("\n");
+    }
+
+    return true;
+}
+
+// json text straight from the tree to the file (no rendered copy)
+template <typename W>
+static bool write_json( Value *v, int fd ) {
+    char write_buf[4096];
+    FdWriteStream os(fd, write_buf, sizeof(write_buf));
+    W writer(os);
+    PackedExpander<W> expander(writer);
+    v->Accept(expander);
+    os.Put('\n');
+    os.Flush();
+    return !os.error();
+}
 
+bool PropertyNode::save( const char *file_path, int format ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( !valid() ) {
+        return false;
+    }
+    bool ok = replace_file(file_path, [this, format](int fd) {
+        if ( format == PROPS2_SAVE_COMPACT ) {
+            return write_json< Writer<FdWriteStream> >(val, fd);
+        }
+        return write_json< PrettyWriter<FdWriteStream> >(val, fd);
+    });
+    if ( !ok ) {
+        PROPS2_ERROR("Write %s failed\n", file_path);
+        return false;
+    }
     return true;
 }
 
@@ -641,9 +3606,14 @@ bool PropertyNode::load( const char *file_path ) {
 // }
 
 void PropertyNode::pretty_print() {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( !valid() ) {
+        return;
+    }
     StringBuffer buffer;
     PrettyWriter<StringBuffer> writer(buffer);
-    val->Accept(writer);
+    PackedExpander< PrettyWriter<StringBuffer> > expander(writer);
+    val->Accept(expander);
 #if defined(ARDUPILOT_BUILD)
     // work around size limitations
     const char *ptr = buffer.GetString();
@@ -658,6 +3628,68 @@ void PropertyNode::pretty_print() {
 #endif
 }
 
+bool PropertyNode::writeBinary( string &buf ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( !valid() ) {
+        return false;
+    }
+    size_t start = buf.length();
+    buf += binary_version;
+    if ( !binary_encode(*val, buf) ) {
+        PROPS2_ERROR("property tree too deeply nested for binary\n");
+        buf.resize(start);
+        return false;
+    }
+    return true;
+}
+
+bool PropertyNode::readBinary( const char *buf, size_t len ) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_STRUCTURE);
+    if ( read_only or !valid() or refuse_allocation(tree, "read binary") ) {
+        return false;
+    }
+    if ( len == 0 or buf[0] != binary_version ) {
+        PROPS2_ERROR("binary property tree version %d, expected %d\n",
+                     len ? (int)buf[0] : -1, (int)binary_version);
+        return false;
+    }
+    Value top;
+    size_t used = binary_decode(buf + 1, len - 1, top, tree->doc->GetAllocator());
+    if ( used == 0 or used != len - 1 or !top.IsObject() ) {
+        PROPS2_ERROR("malformed binary property tree\n");
+        return false;
+    }
+    check_object(tree, val);
+    for (Value::MemberIterator itr = top.MemberBegin(); itr != top.MemberEnd(); ++itr) {
+        add_member(tree, val, itr->name, itr->value);
+    }
+    if ( rec != nullptr ) {
+        props2_touch(tree, rec);
+    }
+    return true;
+}
+
+bool PropertyNode::saveBinary( const char *file_path ) {
+    string image;
+    if ( !writeBinary(image) ) {
+        return false;
+    }
+    if ( !write_image(file_path, image) ) {
+        PROPS2_ERROR("Write %s failed\n", file_path);
+        return false;
+    }
+    return true;
+}
+
+bool PropertyNode::loadBinary( const char *file_path ) {
+    string image;
+    if ( !read_image(file_path, image) ) {
+        PROPS2_ERROR("Read %s failed\n", file_path);
+        return false;
+    }
+    return readBinary(image.data(), image.length());
+}
+
 Document doc;
 
 #if 0
@@ -6,7 +6,9 @@
 
 #include <stdio.h>
 
+#include <functional>
 #include <string>
+#include <type_traits>
 #include <vector>
 using std::string;
 using std::vector;
@@ -19,16 +21,452 @@ using namespace rapidjson;
 // property system style interface with a rapidjson document as the backend
 //
 
+// the default tree's document (nodes made without a PropertyTree)
 extern Document doc;
 
+struct PropertyRecord;
+struct PropertyTreeState;
+struct SnapshotData;
+class PropertyQuery;
+
+// allocator use of a tree (see PropertyTree::getArenaStats())
+struct PropertyArenaStats {
+    size_t arena_size = 0;      // preallocated arena (0 if not an arena tree)
+    size_t high_water = 0;      // bytes handed out (the pool never frees)
+    size_t capacity = 0;        // bytes reserved, over arena_size if the
+                                // arena overflowed onto the heap
+    bool frozen = false;
+    unsigned long refused = 0;  // allocations refused since the freeze
+};
+
+// memory use of a subtree (see PropertyNode::getMemoryStats()).  The
+// allocators are per tree and never free, so the difference between
+// the tree's live bytes and its allocator bytes is space left behind by
+// overwritten strings, regrown arrays, merges, etc. that compact()
+// would give back.
+struct PropertyMemoryStats {
+    size_t live_bytes = 0;      // member, element and string storage
+                                // reachable from the subtree
+    size_t values = 0;          // values in the subtree
+    size_t allocator_bytes = 0; // handed out by the tree's allocators
+    size_t allocator_capacity = 0; // reserved by them
+};
+
+// An independent property tree: its own document (and allocator), path
+// records, member indices, change generations, subscriptions,
+// snapshots and locks.  Nodes made from a tree (PropertyNode(&tree,
+// "/path")) and everything reached through them stay in that tree;
+// nodes made without one use the default tree (the global doc.)  Trees
+// share no state, so separate trees can be used from separate threads
+// without locking or concurrency mode (one per simulation worker, say.)
+// The exception is the snapshot hazard slots: at most 32
+// PropertySnapshots can be held at once across all trees.
+class PropertyTree
+{
+public:
+    PropertyTree();
+    ~PropertyTree();            // the tree's nodes and leaves die with it
+
+    // Arena tree: the document allocator draws from one block of
+    // arena_size bytes allocated here (for real time use, with
+    // freezeAllocations() once initialized.)
+    explicit PropertyTree( size_t arena_size );
+
+    // From now on nothing may allocate from the tree's allocator: any
+    // call that would (creating members or paths, resizing or
+    // converting arrays, copying strings, loading) fails and is logged
+    // as an error, whether or not there would have been room.  Values,
+    // arrays of the same size and strings that fit inline or in their
+    // leaf's buffer (see setString()) can still be set in place.  Path
+    // records (from the heap) are made here for every existing value;
+    // a handle made later to a path without one gets none (it is raw
+    // and untracked) and subscribing is refused.
+    void freezeAllocations();
+    bool allocationsFrozen();
+    PropertyArenaStats getArenaStats();
+
+    // memory use of the whole tree
+    PropertyMemoryStats getMemoryStats();
+
+    // Copy the tree into a fresh allocator (arena trees: back into the
+    // reset arena) and release the old one, reclaiming everything the
+    // pool has leaked.  Stable nodes and leaves re-resolve into the new
+    // copy; raw ones (made from a Value pointer or with stable handles
+    // off) are left dangling.  Needs room for both copies while it
+    // runs, and fails if allocations are frozen.
+    bool compact();
+
+    static PropertyTree *getDefault();
+
+    Document &getDocument() { return *doc; }
+
+    // see PropertyNode for these
+    void setStableHandles( bool enable );
+    void setPackedArrays( int min_len );
+    void setConcurrent( bool enable );
+    uint64_t getGeneration();
+    void unsubscribe( int id );
+    int dispatch();
+
+    // internals shared with the inline handle code (see props2.cpp)
+    Document *doc;
+    uint32_t structure_gen = 1; // bumped when storage may have moved
+    bool concurrent = false;
+    PropertyTreeState *state;
+
+private:
+    PropertyTree( Document *d );
+    PropertyTree(const PropertyTree &);
+    PropertyTree &operator=(const PropertyTree &);
+
+    Document *owned_doc = nullptr;
+};
+
+// stable handle support (see props2.cpp)
+Value *props2_resolve( PropertyTree *tree, PropertyRecord *rec );
+
+// change tracking support (see props2.cpp)
+void props2_touch( PropertyTree *tree, PropertyRecord *rec );
+
+// concurrency mode support (see props2.cpp)
+enum PropertyLockMode {
+    PROPS2_LOCK_NONE = -1,      // no lock held
+    PROPS2_LOCK_READ,
+    PROPS2_LOCK_WRITE,
+    PROPS2_LOCK_STRUCTURE
+};
+int props2_lock( PropertyTree *tree, PropertyRecord *rec, int mode, bool leaf );
+void props2_unlock( PropertyTree *tree, PropertyRecord *rec, int mode, bool leaf );
+
+// holds the locks for one access in concurrency mode (nothing
+// otherwise), rec is the node's record or a leaf's own record.  Nodes
+// outside any tree (snapshots) are never locked.
+class PropertyLock
+{
+public:
+    PropertyLock(PropertyTree *t, PropertyRecord *r, int m, bool leaf=false):
+        tree(t), rec(r), leaf(leaf)
+    {
+        mode = -1;
+        if ( tree != nullptr and tree->concurrent ) {
+            mode = props2_lock(tree, rec, m, leaf);
+        }
+    }
+    ~PropertyLock() {
+        if ( mode >= 0 ) {
+            props2_unlock(tree, rec, mode, leaf);
+        }
+    }
+
+    // trade a read or write lock for the structure lock
+    void escalate() {
+        if ( mode >= 0 and mode != PROPS2_LOCK_STRUCTURE ) {
+            props2_unlock(tree, rec, mode, leaf);
+            mode = props2_lock(tree, rec, PROPS2_LOCK_STRUCTURE, leaf);
+        }
+    }
+
+private:
+    PropertyLock(const PropertyLock &);
+    PropertyLock &operator=(const PropertyLock &);
+
+    PropertyTree *tree;
+    PropertyRecord *rec;
+    int mode;
+    bool leaf;
+};
+
+// a path parsed once up front (array indices already converted) so it
+// can be resolved repeatedly without any string parsing
+class PropertyPath
+{
+public:
+    PropertyPath(const char *path);
+    PropertyPath(const string &path);
+
+private:
+    friend class PropertyNode;
+    Value *resolve(PropertyTree *tree, Value *start_node, bool create) const;
+    Value *lookup(PropertyTree *tree, Value *start_node) const;
+    PropertyRecord *record(PropertyTree *tree, PropertyRecord *rec) const;
+
+    struct Token {
+        int name_pos;           // offset of token name in names
+        int name_len;
+        int index;              // array index or -1 for a member name
+    };
+    bool absolute = false;
+    string names;               // token names stored back to back
+    vector<Token> tokens;
+};
+
+// load() options
+enum PropertyLoadFlags {
+    // read the whole file into a buffer owned by the tree and parse it
+    // in place: keys and strings point into the buffer rather than being
+    // copied (the buffer lives as long as the tree)
+    PROPS2_LOAD_INSITU = 1 << 0,
+
+    // read and parse "include" files concurrently on a few worker
+    // threads (merged in the same order as a serial load; ignored on
+    // ArduPilot builds)
+    PROPS2_LOAD_PARALLEL_INCLUDES = 1 << 1,
+
+    // use (and maintain) a binary image of the include expanded config
+    // beside it (<file>.cache), rebuilt whenever the config or any of
+    // its include files change (mtime or size)
+    PROPS2_LOAD_USE_CACHE = 1 << 2
+};
+
+// save() formats
+enum PropertySaveFormat {
+    PROPS2_SAVE_COMPACT,        // no whitespace
+    PROPS2_SAVE_PRETTY          // indented like pretty_print()
+};
+
+// subscription callback, called from PropertyNode::dispatch() with the
+// absolute path that was subscribed to
+typedef std::function<void(const string &path)> PropertyCallback;
+
+// visitor for PropertyNode::visitChildren() (ctx is passed through),
+// return false to stop
+struct PropertyChild;
+typedef bool (*PropertyVisitor)(PropertyChild &child, void *ctx);
+
+// value conversions (any json type to the requested type)
+bool getValueAsBool( Value &v );
+int getValueAsInt( Value &v );
+unsigned int getValueAsUInt( Value &v );
+float getValueAsFloat( Value &v );
+double getValueAsDouble( Value &v );
+string getValueAsString( Value &v );
+
+// A leaf value bound once by name (see PropertyNode::bindDouble(),
+// etc.) that points directly at the leaf value in the tree.  get() and
+// set() are a type check plus a load or store, with the general
+// conversion only used when the stored type differs.  Leaves bound
+// from a stable node re-resolve themselves if the tree storage has
+// moved since they were last used.  A leaf whose member has gone (its
+// parent replaced by a scalar, say) reads as zero and ignores sets.
+template <typename T>
+class PropertyLeaf
+{
+public:
+    PropertyLeaf() {}
+    PropertyLeaf(PropertyTree *t, Value *v, PropertyRecord *r=nullptr):
+        tree(t), val(v), rec(r), gen(t->structure_gen) {}
+
+    bool isNull() {
+        PropertyLock lock(tree, rec, PROPS2_LOCK_READ, true);
+        return value() == nullptr;
+    }
+
+    inline T get();
+    inline void set(T x);
+
+private:
+    friend class PropertyQuery;
+
+    // store x keeping the member's own numeric type (query sets)
+    inline void set_number(double x);
+
+    inline Value *value() {
+        if ( rec != nullptr and gen != tree->structure_gen ) {
+            val = props2_resolve(tree, rec);
+            gen = tree->structure_gen;
+        }
+        return val;
+    }
+
+    // stamp the change (bound from a stable node)
+    inline void touched() {
+        if ( rec != nullptr ) {
+            props2_touch(tree, rec);
+        }
+    }
+
+    // setting a scalar over a container discards its children (a
+    // structural change), false if the value is gone by the time the
+    // structure lock is held
+    inline bool check_replace(Value *&v, PropertyLock &lock) {
+        if ( v->IsObject() or v->IsArray() ) {
+            lock.escalate();
+            v = value();
+            if ( v == nullptr ) {
+                return false;
+            }
+            tree->structure_gen++;
+        }
+        return true;
+    }
+
+    PropertyTree *tree = nullptr;
+    Value *val = nullptr;
+    PropertyRecord *rec = nullptr;
+    uint32_t gen = 0;
+};
+
+template <> inline bool PropertyLeaf<bool>::get() {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ, true);
+    Value *v = value();
+    if ( v == nullptr ) {
+        return 0;               // the member is gone
+    }
+    if ( v->IsBool() ) {
+        return v->GetBool();
+    }
+    return getValueAsBool(*v);
+}
+
+template <> inline void PropertyLeaf<bool>::set(bool b) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE, true);
+    Value *v = value();
+    if ( v == nullptr or !check_replace(v, lock) ) {
+        return;                 // the member is gone
+    }
+    v->SetBool(b);
+    touched();
+}
+
+template <> inline int PropertyLeaf<int>::get() {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ, true);
+    Value *v = value();
+    if ( v == nullptr ) {
+        return 0;               // the member is gone
+    }
+    if ( v->IsInt() ) {
+        return v->GetInt();
+    }
+    return getValueAsInt(*v);
+}
+
+template <> inline void PropertyLeaf<int>::set(int n) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE, true);
+    Value *v = value();
+    if ( v == nullptr or !check_replace(v, lock) ) {
+        return;                 // the member is gone
+    }
+    v->SetInt(n);
+    touched();
+}
+
+template <> inline unsigned int PropertyLeaf<unsigned int>::get() {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ, true);
+    Value *v = value();
+    if ( v == nullptr ) {
+        return 0;               // the member is gone
+    }
+    if ( v->IsUint() ) {
+        return v->GetUint();
+    }
+    return getValueAsUInt(*v);
+}
+
+template <> inline void PropertyLeaf<unsigned int>::set(unsigned int u) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE, true);
+    Value *v = value();
+    if ( v == nullptr or !check_replace(v, lock) ) {
+        return;                 // the member is gone
+    }
+    v->SetUint(u);
+    touched();
+}
+
+template <> inline float PropertyLeaf<float>::get() {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ, true);
+    Value *v = value();
+    if ( v == nullptr ) {
+        return 0;               // the member is gone
+    }
+    if ( v->IsDouble() ) {
+        return v->GetDouble();
+    }
+    return getValueAsFloat(*v);
+}
+
+template <> inline void PropertyLeaf<float>::set(float x) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE, true);
+    Value *v = value();
+    if ( v == nullptr or !check_replace(v, lock) ) {
+        return;                 // the member is gone
+    }
+    v->SetFloat(x);
+    touched();
+}
+
+template <> inline double PropertyLeaf<double>::get() {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_READ, true);
+    Value *v = value();
+    if ( v == nullptr ) {
+        return 0;               // the member is gone
+    }
+    if ( v->IsDouble() ) {
+        return v->GetDouble();
+    }
+    return getValueAsDouble(*v);
+}
+
+template <> inline void PropertyLeaf<double>::set(double x) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE, true);
+    Value *v = value();
+    if ( v == nullptr or !check_replace(v, lock) ) {
+        return;                 // the member is gone
+    }
+    v->SetDouble(x);
+    touched();
+}
+
+template <class T> inline void PropertyLeaf<T>::set_number(double x) {
+    PropertyLock lock(tree, rec, PROPS2_LOCK_WRITE, true);
+    Value *v = value();
+    if ( v == nullptr or !v->IsNumber() ) {
+        return;                 // gone, or no longer a number
+    }
+    if ( v->IsInt() ) {
+        v->SetInt((int)x);
+    } else if ( v->IsUint() ) {
+        v->SetUint((unsigned int)x);
+    } else if ( v->IsInt64() ) {
+        v->SetInt64((int64_t)x);
+    } else if ( v->IsUint64() ) {
+        v->SetUint64((uint64_t)x);
+    } else {
+        v->SetDouble(x);
+    }
+    touched();
+}
+
 class PropertyNode
 {
 public:
     // Constructor.
     PropertyNode();
-    PropertyNode(string abs_path, bool create=true);
+    PropertyNode(const char *abs_path, bool create=true);
+    PropertyNode(const string &abs_path, bool create=true);
+    PropertyNode(const PropertyPath &abs_path, bool create=true);
     PropertyNode(Value *v);
 
+    // nodes of a specific tree (the ones above are in the default tree)
+    PropertyNode(PropertyTree *tree, const char *abs_path, bool create=true);
+    PropertyNode(PropertyTree *tree, const string &abs_path, bool create=true);
+    PropertyNode(PropertyTree *tree, const PropertyPath &abs_path, bool create=true);
+
+    // nodes and leaves made from paths are stable handles by default
+    // (they survive tree storage relocation), disable to get raw value
+    // pointers
+    static void setStableHandles( bool enable );
+
+    // concurrency mode: threads may read and write the tree at the same
+    // time through stable nodes and leaves, accesses to different nodes
+    // run in parallel (see props2.cpp.)  Enable before starting the
+    // threads.  Handles themselves aren't shared between threads.
+    // Any thread may subscribe or unsubscribe, callbacks run in the
+    // dispatching thread with other threads' tree access held off.
+    // These static settings (and setStableHandles(), setPackedArrays())
+    // apply to the default tree, the PropertyTree methods of the same
+    // name to any other.
+    static void setConcurrent( bool enable );
+
     // Destructor.
     // ~PropertyNode();
 
@@ -38,6 +476,7 @@ public:
     bool hasChild(const char *name );
     PropertyNode getChild( const char *name, bool create=true );
     PropertyNode getChild( const char *name, int index, bool create=true );
+    PropertyNode getChild( const PropertyPath &path, bool create=true );
 
     bool isNull();		// return true if pObj pointer is NULL
     
@@ -47,6 +486,22 @@ public:
 
     vector<string> getChildren(bool expand=true); // return list of children
 
+    // call visit for each child (as getChildren() lists them, arrays
+    // expanded into their elements unless expand is false) straight
+    // from the tree: no strings are built and nothing is allocated.
+    // Stops early if visit returns false, returns the number visited.
+    // The tree is locked for the walk, so visit may read and set
+    // values but must not add or remove anything.  visit is any
+    // callable taking a PropertyChild & (a lambda is called directly,
+    // not through a std::function), or a function pointer and context.
+    int visitChildren( PropertyVisitor visit, void *ctx, bool expand=true );
+    template <class F> int visitChildren( F &&visit, bool expand=true ) {
+        typedef typename std::remove_reference<F>::type Visitor;
+        return visitChildren([](PropertyChild &child, void *ctx) {
+            return (bool)(*(Visitor *)ctx)(child);
+        }, (void *)&visit, expand);
+    }
+
     bool isLeaf( const char *name); // return true if pObj/name is leaf
     
     // value getters
@@ -71,20 +526,197 @@ public:
     bool setUInt( const char *name, unsigned int u ); // returns true if successful
     bool setFloat( const char *name, float x ); // returns true if successful
     bool setDouble( const char *name, double x ); // returns true if successful
-    bool setString( const char *name, string s ); // returns true if successful
+    bool setString( const char *name, const char *s ); // returns true if successful
+    bool setString( const char *name, const string &s ); // returns true if successful
 
     // indexed value setters
     bool setFloat( const char *name, int index, float x ); // returns true if successful
 
-    // load/merge json file under this node
-    bool load( const char *file_path );
+    // bulk array getters: copy up to count elements of array name into
+    // dst, returns the number of elements copied
+    int getDoubleArray( const char *name, double *dst, int count );
+    int getFloatArray( const char *name, float *dst, int count );
+    int getIntArray( const char *name, int *dst, int count );
+
+    // bulk array setters: size array name to count elements and copy
+    // src in, returns true if successful
+    bool setDoubleArray( const char *name, const double *src, int count );
+    bool setFloatArray( const char *name, const float *src, int count );
+    bool setIntArray( const char *name, const int *src, int count );
+
+    // packed arrays: homogeneous numeric arrays stored contiguously
+    // (see props2_packed.h) as int32 or double elements, they read,
+    // write and print like regular arrays.  packArray() converts an
+    // existing numeric array member, load() packs numeric arrays of at
+    // least min_len elements (16 unless set, so on by default.)  The
+    // raw Value of a packed array (get_valptr()) is a string holding
+    // the block, not a json array.
+    bool isPacked( const char *name );
+    bool packArray( const char *name );
+    static void setPackedArrays( int min_len ); // 0 disables packing on load
+
+    // change tracking: each setter (and load) stamps the value it sets
+    // and that value's ancestors with a new generation.  Remember
+    // getGeneration() and later ask a node what has changed under it
+    // since then; getChangedSince() returns the changed values as paths
+    // relative to this node ("" is the node itself.)  Only stable nodes
+    // and leaves are tracked, raw nodes always report a change.
+    static uint64_t getGeneration();
+    bool changedSince( uint64_t gen );
+    vector<string> getChangedSince( uint64_t gen );
+
+    // subscriptions: cb is called from dispatch() if the value at path
+    // (relative to this node, a leaf or a whole subtree) has been set
+    // since the previous dispatch().  Setters only stamp generations;
+    // call dispatch() once per frame to deliver at most one call per
+    // subscription.  subscribe() returns an id for unsubscribe(), or -1
+    // under a raw (untracked) node.
+    int subscribe( const char *path, PropertyCallback cb );
+    static void unsubscribe( int id );
+    static int dispatch(); // returns the number of callbacks made
+
+    // bind a leaf handle to a member (created if needed) for fast
+    // repeated get()/set()
+    PropertyLeaf<bool> bindBool( const char *name );
+    PropertyLeaf<int> bindInt( const char *name );
+    PropertyLeaf<unsigned int> bindUInt( const char *name );
+    PropertyLeaf<float> bindFloat( const char *name );
+    PropertyLeaf<double> bindDouble( const char *name );
+
+    // match leaves by a wildcard pattern (see PropertyQuery), relative
+    // to this node or absolute from the root of its tree
+    PropertyQuery query( const char *pattern );
+
+    // load/merge json file under this node (flags: PropertyLoadFlags)
+    bool load( const char *file_path, unsigned int flags = 0 );
     
+    // write this subtree to a json file (packed arrays as plain
+    // arrays), streamed through a small fixed buffer, synced and
+    // renamed into place so readers never see a partial file (saveBinary()
+    // and the config cache are written the same way.)  The tree is locked
+    // while it writes; save a snapshot's node to keep a concurrent tree
+    // moving.
+    bool save( const char *file_path, int format = PROPS2_SAVE_PRETTY );
+
     // void print();
     void pretty_print();
 
-    Value *get_valptr() {  return val; }
+    // compact binary form of this subtree (see props2_binary.h), led
+    // by a version byte: writeBinary() appends it to buf, readBinary()
+    // merges an encoded subtree under this node like load() does
+    bool writeBinary( string &buf );
+    bool readBinary( const char *buf, size_t len );
+    bool saveBinary( const char *file_path );
+    bool loadBinary( const char *file_path );
+
+    // publish a copy of this subtree as the latest snapshot of its path
+    // for other threads to read (see PropertySnapshot)
+    bool publishSnapshot();
+
+    // live bytes of this subtree against the tree's allocator totals
+    PropertyMemoryStats getMemoryStats();
+
+    // raw value (a packed array is a string Value, see setPackedArrays())
+    Value *get_valptr() { revalidate(); return val; }
     
 private:
+    friend class PropertySnapshot;
+    friend class PropertyQuery;
+
+    // re-resolve val through the path record if the tree storage may
+    // have moved since it was cached
+    inline void revalidate() {
+        if ( rec != nullptr and gen != tree->structure_gen ) {
+            rebind();
+        }
+    }
+    void rebind();
+
+    // revalidate and check the node (still) exists
+    inline bool valid() {
+        revalidate();
+        return val != nullptr;
+    }
+    void set_node( Value *node, PropertyRecord *path_rec );
+    bool store_string( const char *name, const char *s, SizeType len );
+
     // Pointer p;
+    PropertyTree *tree = nullptr;  // nullptr for snapshot nodes
     Value *val = nullptr;
+    PropertyRecord *rec = nullptr; // path record (stable handles)
+    uint32_t gen = 0;              // tree->structure_gen val is valid for
+    bool read_only = false;        // snapshot node
+};
+
+// a child passed to PropertyNode::visitChildren()'s visitor, only valid
+// during the call
+struct PropertyChild {
+    const char *name;           // member name, name_len chars (not
+    int name_len;               // necessarily nul terminated)
+    int index;                  // array element or -1
+    bool leaf;                  // a value rather than an object or array
+    PropertyNode node;          // raw node (read only for elements of
+                                // packed arrays, which are copies)
+};
+
+// The leaves matched by a path pattern, bound once so a whole set of
+// enumerated devices can be read or written each frame with one call
+// (no string building, lookups or allocation.)  Pattern tokens are
+// member names, array indices, "*" (any member or element) and "**"
+// (any number of levels, including none); the last token names the
+// leaves (or "*" for every numeric member), e.g. "/sensors/imu/*/az" or
+// "/actuators/**/cmd".  Leaves are kept in tree order, as stable
+// handles when the tree has them.  Matches are found when the query
+// is made; refresh() to pick up devices added (or drop ones removed)
+// since.
+class PropertyQuery
+{
+public:
+    PropertyQuery() {}
+
+    int size() { return leaves.size(); }
+    const string &getPath( int i ) { return paths[i]; } // relative
+
+    // copy up to count leaf values out or in, in match order, returns
+    // the number of leaves read or written.  A set keeps the leaf's
+    // type (an int leaf is truncated, not made a double.)
+    int getDoubles( double *dst, int count );
+    int setDoubles( const double *src, int count );
+    int getFloats( float *dst, int count );
+    int setFloats( const float *src, int count );
+
+    bool refresh();             // match again, false on a bad pattern
+
+private:
+    friend class PropertyNode;
+
+    PropertyNode base;          // node the pattern is relative to
+    string pattern;
+    vector<string> paths;       // match paths relative to base
+    vector< PropertyLeaf<double> > leaves;
+};
+
+// A consistent, immutable copy of a subtree published with
+// PropertyNode::publishSnapshot(), typically by the control thread at
+// the end of each frame, for other threads to read without touching
+// the live tree.  Constructing one pins the latest snapshot of a path
+// until it goes out of scope.  Nodes from getNode() are read only (set
+// calls fail) and must not outlive it.
+class PropertySnapshot
+{
+public:
+    PropertySnapshot(const char *abs_path); // default tree
+    PropertySnapshot(PropertyTree *tree, const char *abs_path);
+    ~PropertySnapshot();
+
+    bool isNull() { return snap == nullptr; }
+    PropertyNode getNode();     // root of the copied subtree
+    uint64_t getGeneration();   // change generation it was taken at
+
+private:
+    PropertySnapshot(const PropertySnapshot &);
+    PropertySnapshot &operator=(const PropertySnapshot &);
+
+    SnapshotData *snap = nullptr;
+    int slot = -1;              // hazard slot pinning snap
 };
@@ -0,0 +1,295 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "props2_binary.h"
+#include "props2_packed.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#  error "props2 binary encoding assumes a little endian host"
+#endif
+
+enum {
+    BIN_NULL = 0,
+    BIN_FALSE = 1,
+    BIN_TRUE = 2,
+    BIN_INT = 3,
+    BIN_UINT = 4,
+    BIN_DOUBLE = 5,
+    BIN_STRING = 6,
+    BIN_ARRAY = 7,
+    BIN_OBJECT = 8,
+    BIN_PACKED = 9
+};
+
+// nesting allowed (in both directions, so whatever encodes decodes)
+static const int max_depth = 64;
+
+static void put_varint( uint64_t u, std::string &out ) {
+    while ( u >= 0x80 ) {
+        out += (char)(u | 0x80);
+        u >>= 7;
+    }
+    out += (char)u;
+}
+
+static void put_string( const char *str, size_t len, std::string &out ) {
+    put_varint(len, out);
+    out.append(str, len);
+}
+
+// keys already written in this encoding (and their index)
+typedef std::unordered_map<std::string, uint32_t> KeyTable;
+
+static void put_key( const char *name, size_t len, KeyTable &keys,
+                     std::string &out )
+{
+    std::string key(name, len);
+    KeyTable::iterator itr = keys.find(key);
+    if ( itr != keys.end() ) {
+        put_varint((uint64_t)itr->second << 1 | 1, out);
+    } else {
+        uint32_t index = keys.size();
+        keys[key] = index;
+        put_varint((uint64_t)len << 1, out);
+        out.append(name, len);
+    }
+}
+
+static bool encode( const Value &v, KeyTable &keys, std::string &out,
+                    int depth )
+{
+    if ( depth > max_depth ) {
+        return false;
+    }
+    if ( v.IsNull() ) {
+        out += (char)BIN_NULL;
+    } else if ( v.IsBool() ) {
+        out += (char)(v.GetBool() ? BIN_TRUE : BIN_FALSE);
+    } else if ( v.IsDouble() ) {
+        double d = v.GetDouble();
+        out += (char)BIN_DOUBLE;
+        out.append((const char *)&d, sizeof(d));
+    } else if ( v.IsUint64() ) {
+        out += (char)BIN_UINT;
+        put_varint(v.GetUint64(), out);
+    } else if ( v.IsInt64() ) {
+        int64_t i = v.GetInt64();
+        out += (char)BIN_INT;
+        put_varint(((uint64_t)i << 1) ^ (uint64_t)(i >> 63), out);
+    } else if ( is_packed(v) ) {
+        Value &p = const_cast<Value &>(v);
+        int count = packed_count(p);
+        out += (char)BIN_PACKED;
+        out += packed_type(p);
+        put_varint(count, out);
+        out.append((const char *)packed_data(p),
+                   count * packed_element_size(packed_type(p)));
+    } else if ( v.IsString() ) {
+        out += (char)BIN_STRING;
+        put_string(v.GetString(), v.GetStringLength(), out);
+    } else if ( v.IsArray() ) {
+        out += (char)BIN_ARRAY;
+        put_varint(v.Size(), out);
+        for ( Value::ConstValueIterator e = v.Begin(); e != v.End(); ++e ) {
+            if ( !encode(*e, keys, out, depth + 1) ) {
+                return false;
+            }
+        }
+    } else if ( v.IsObject() ) {
+        out += (char)BIN_OBJECT;
+        put_varint(v.MemberCount(), out);
+        for ( Value::ConstMemberIterator itr = v.MemberBegin(); itr != v.MemberEnd(); ++itr ) {
+            put_key(itr->name.GetString(), itr->name.GetStringLength(), keys,
+                    out);
+            if ( !encode(itr->value, keys, out, depth + 1) ) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool binary_encode( const Value &v, std::string &out ) {
+    KeyTable keys;
+    size_t start = out.length();
+    if ( !encode(v, keys, out, 0) ) {
+        out.resize(start);
+        return false;
+    }
+    return true;
+}
+
+// bounds checked reader over the input
+struct BinaryReader {
+    const char *p;
+    const char *end;
+    MemoryPoolAllocator<> &allocator;
+    std::vector<Value> keys;    // keys seen so far (refer into the input)
+
+    bool get_varint( uint64_t *u ) {
+        *u = 0;
+        for ( int shift = 0; shift < 64; shift += 7 ) {
+            if ( p >= end ) {
+                return false;
+            }
+            uint8_t b = *p++;
+            *u |= (uint64_t)(b & 0x7f) << shift;
+            if ( !(b & 0x80) ) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // a length that must fit in the remaining input
+    bool get_length( size_t unit, size_t *len ) {
+        uint64_t u;
+        if ( !get_varint(&u) or u > (uint64_t)(end - p) / unit ) {
+            return false;
+        }
+        *len = u;
+        return true;
+    }
+
+    bool key( Value &k ) {
+        uint64_t u;
+        if ( !get_varint(&u) ) {
+            return false;
+        }
+        if ( u & 1 ) {
+            u >>= 1;
+            if ( u >= keys.size() ) {
+                return false;
+            }
+            k.SetString(keys[u].GetString(), keys[u].GetStringLength(),
+                        allocator);
+            return true;
+        }
+        u >>= 1;
+        if ( u > (uint64_t)(end - p) ) {
+            return false;
+        }
+        keys.push_back(Value(StringRef(p, u)));
+        k.SetString(p, u, allocator);
+        p += u;
+        return true;
+    }
+
+    bool value( Value &v, int depth );
+};
+
+bool BinaryReader::value( Value &v, int depth ) {
+    if ( p >= end or depth > max_depth ) {
+        return false;
+    }
+    uint64_t u;
+    size_t len;
+    switch ( *p++ ) {
+    case BIN_NULL:
+        v.SetNull();
+        return true;
+    case BIN_FALSE:
+        v.SetBool(false);
+        return true;
+    case BIN_TRUE:
+        v.SetBool(true);
+        return true;
+    case BIN_INT:
+        if ( !get_varint(&u) ) {
+            return false;
+        }
+        v.SetInt64((int64_t)(u >> 1) ^ -(int64_t)(u & 1));
+        return true;
+    case BIN_UINT:
+        if ( !get_varint(&u) ) {
+            return false;
+        }
+        v.SetUint64(u);
+        return true;
+    case BIN_DOUBLE: {
+        double d;
+        if ( end - p < (ptrdiff_t)sizeof(d) ) {
+            return false;
+        }
+        memcpy(&d, p, sizeof(d));
+        p += sizeof(d);
+        v.SetDouble(d);
+        return true;
+    }
+    case BIN_STRING:
+        if ( !get_length(1, &len) or is_packed(Value(StringRef(p, len))) ) {
+            return false;       // packed arrays are encoded as such
+        }
+        v.SetString(p, len, allocator);
+        p += len;
+        return true;
+    case BIN_ARRAY:
+        // every element takes at least one byte
+        if ( !get_length(1, &len) ) {
+            return false;
+        }
+        v.SetArray();
+        v.Reserve(len, allocator);
+        for ( size_t i = 0; i < len; i++ ) {
+            Value e;
+            if ( !value(e, depth + 1) ) {
+                return false;
+            }
+            v.PushBack(e, allocator);
+        }
+        return true;
+    case BIN_OBJECT:
+        // and every member at least two
+        if ( !get_length(2, &len) ) {
+            return false;
+        }
+        v.SetObject();
+        v.MemberReserve(len, allocator);
+        for ( size_t i = 0; i < len; i++ ) {
+            Value k;
+            if ( !key(k) ) {
+                return false;
+            }
+            Value e;
+            if ( !value(e, depth + 1) ) {
+                return false;
+            }
+            v.AddMember(k, e, allocator);
+        }
+        return true;
+    case BIN_PACKED: {
+        if ( p >= end ) {
+            return false;
+        }
+        char type = *p++;
+        if ( type != PACKED_DOUBLE and type != PACKED_INT ) {
+            return false;
+        }
+        size_t size = packed_element_size(type);
+        if ( !get_length(size, &len) ) {
+            return false;
+        }
+        make_packed(v, type, len, allocator);
+        memcpy(packed_data(v), p, len * size);
+        p += len * size;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+size_t binary_decode( const char *data, size_t len, Value &v,
+                      MemoryPoolAllocator<> &allocator )
+{
+    BinaryReader reader = { data, data + len, allocator,
+                            std::vector<Value>() };
+    if ( !reader.value(v, 0) ) {
+        v.SetNull();
+        return 0;
+    }
+    return reader.p - data;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+// Compact binary encoding of a property (sub)tree.
+//
+// Every value is a one byte tag followed by its payload:
+//
+//   null, false, true    tag only
+//   int                  zigzag varint (negative values)
+//   uint                 varint
+//   double               8 bytes
+//   string               varint length, bytes
+//   array                varint count, values
+//   object               varint count, (key, value)...
+//   packed array         element type, varint count, raw elements
+//
+// A key is written out (varint length << 1, bytes) the first time it
+// appears in an encoding; after that it is a reference to it (varint
+// index << 1 | 1), which is what makes repetitive config trees small.
+//
+// Numbers are little endian.  Decoding checks every length against the
+// input so a truncated or corrupt image fails cleanly.  Nesting is
+// limited (64 levels) and encoding refuses a deeper tree rather than
+// write an image that can't be read back.
+//
+// PropertyNode::writeBinary() puts binary_version in front of the
+// encoding and readBinary() refuses any other, so a change to the tags
+// or key encoding must bump it.
+
+#include <stddef.h>
+
+#include <string>
+
+#include "rapidjson/document.h"
+using namespace rapidjson;
+
+// version byte leading a PropertyNode::writeBinary() image
+static const char binary_version = 2;
+
+// append the encoding of v to out, false (leaving out as it was) if v
+// is nested deeper than the decoder accepts
+bool binary_encode( const Value &v, std::string &out );
+
+// decode one value from data (len bytes) into v, strings are copied
+// with allocator.  Returns the number of bytes used, 0 if malformed.
+size_t binary_decode( const char *data, size_t len, Value &v,
+                      MemoryPoolAllocator<> &allocator );
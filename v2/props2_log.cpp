@@ -0,0 +1,43 @@
+#if defined(ARDUPILOT_BUILD)
+#  include <AP_HAL/AP_HAL.h>
+#else
+#  include <time.h>
+#  include <mutex>
+#endif
+
+#include "props2_log.h"
+
+static uint32_t log_millis() {
+#if defined(ARDUPILOT_BUILD)
+    return AP_HAL::millis();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+bool props2_log_allow( props2_log_site *site ) {
+#if !defined(ARDUPILOT_BUILD)
+    // sites can be shared by threads (concurrency mode)
+    static std::mutex log_mutex;
+    std::lock_guard<std::mutex> guard(log_mutex);
+#endif
+    uint32_t now = log_millis();
+    if ( now - site->window_start_ms >= props2_log_window_ms ) {
+        if ( site->suppressed > 0 ) {
+            printf("(props2: %d messages suppressed)\n", site->suppressed);
+        }
+        site->window_start_ms = now;
+        site->count = 0;
+        site->suppressed = 0;
+    }
+    if ( site->count < props2_log_burst ) {
+        site->count++;
+        return true;
+    }
+    if ( site->suppressed < UINT16_MAX ) {
+        site->suppressed++;
+    }
+    return false;
+}
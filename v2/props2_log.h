@@ -0,0 +1,78 @@
+#pragma once
+
+// Diagnostics for the v2 property tree.
+//
+// Every message has a severity level.  Messages above PROPS2_LOG_LEVEL
+// are compiled out entirely (arguments are not evaluated).  Release
+// builds (NDEBUG) default to PROPS2_LOG_NONE so no diagnostic code is
+// left on any path; debug builds default to PROPS2_LOG_DEBUG and rate
+// limit each call site at runtime so a message in a hot loop can't
+// stall it with console i/o.  Define PROPS2_LOG_LEVEL on the compiler
+// command line to override.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PROPS2_LOG_NONE  0
+#define PROPS2_LOG_ERROR 1
+#define PROPS2_LOG_WARN  2
+#define PROPS2_LOG_INFO  3
+#define PROPS2_LOG_DEBUG 4
+
+#if !defined(PROPS2_LOG_LEVEL)
+#  if defined(NDEBUG)
+#    define PROPS2_LOG_LEVEL PROPS2_LOG_NONE
+#  else
+#    define PROPS2_LOG_LEVEL PROPS2_LOG_DEBUG
+#  endif
+#endif
+
+// per call site rate limit state (lives in a function local static)
+struct props2_log_site {
+    uint32_t window_start_ms;
+    uint16_t count;             // messages printed in this window
+    uint16_t suppressed;        // messages dropped in this window
+};
+
+// messages allowed per call site per window
+static const int props2_log_burst = 5;
+static const uint32_t props2_log_window_ms = 1000;
+
+// returns true if this call site may print now
+bool props2_log_allow( props2_log_site *site );
+
+#define PROPS2_LOG_ENABLED(level) ((level) <= PROPS2_LOG_LEVEL)
+
+#define PROPS2_LOG(level, ...)                                  \
+    do {                                                        \
+        if ( PROPS2_LOG_ENABLED(level) ) {                      \
+            static props2_log_site props2_site_;                \
+            if ( props2_log_allow(&props2_site_) ) {            \
+                printf(__VA_ARGS__);                            \
+            }                                                   \
+        }                                                       \
+    } while ( 0 )
+
+#if PROPS2_LOG_LEVEL >= PROPS2_LOG_ERROR
+#  define PROPS2_ERROR(...) PROPS2_LOG(PROPS2_LOG_ERROR, __VA_ARGS__)
+#else
+#  define PROPS2_ERROR(...) do { } while ( 0 )
+#endif
+
+#if PROPS2_LOG_LEVEL >= PROPS2_LOG_WARN
+#  define PROPS2_WARN(...) PROPS2_LOG(PROPS2_LOG_WARN, __VA_ARGS__)
+#else
+#  define PROPS2_WARN(...) do { } while ( 0 )
+#endif
+
+#if PROPS2_LOG_LEVEL >= PROPS2_LOG_INFO
+#  define PROPS2_INFO(...) PROPS2_LOG(PROPS2_LOG_INFO, __VA_ARGS__)
+#else
+#  define PROPS2_INFO(...) do { } while ( 0 )
+#endif
+
+#if PROPS2_LOG_LEVEL >= PROPS2_LOG_DEBUG
+#  define PROPS2_DEBUG(...) PROPS2_LOG(PROPS2_LOG_DEBUG, __VA_ARGS__)
+#else
+#  define PROPS2_DEBUG(...) do { } while ( 0 )
+#endif
@@ -0,0 +1,97 @@
+#include "props2_packed.h"
+
+void make_packed( Value &v, char type, int count,
+                  MemoryPoolAllocator<> &allocator )
+{
+    SizeType len = packed_length(type, count);
+    // allocated directly (rather than copied in by SetString()) to
+    // avoid building the block twice; the pool never frees, so the
+    // const string reference owns it for the life of the tree
+    char *block = (char *)allocator.Malloc(len + 1);
+    memset(block, 0, len + 1);
+    PackedHeader *h = (PackedHeader *)block;
+    h->magic[1] = 'P';
+    h->magic[2] = 'K';
+    h->type = type;
+    h->count = count;
+    v.SetString(StringRef(block, len));
+}
+
+bool contains_packed( const Value &v ) {
+    if ( v.IsObject() ) {
+        for ( Value::ConstMemberIterator itr = v.MemberBegin(); itr != v.MemberEnd(); ++itr ) {
+            if ( contains_packed(itr->value) ) {
+                return true;
+            }
+        }
+    } else if ( v.IsArray() ) {
+        for ( Value::ConstValueIterator e = v.Begin(); e != v.End(); ++e ) {
+            if ( contains_packed(*e) ) {
+                return true;
+            }
+        }
+    }
+    return is_packed(v);
+}
+
+bool pack_array( Value &v, MemoryPoolAllocator<> &allocator ) {
+    if ( !v.IsArray() ) {
+        return false;
+    }
+    bool all_int = true;
+    for ( Value::ValueIterator e = v.Begin(); e != v.End(); ++e ) {
+        if ( !e->IsNumber() ) {
+            return false;
+        }
+        if ( !e->IsInt() ) {
+            all_int = false;
+        }
+    }
+    int count = v.Size();
+    Value packed;
+    make_packed(packed, all_int ? PACKED_INT : PACKED_DOUBLE, count,
+                allocator);
+    Value *elements = v.Begin();
+    for ( int i = 0; i < count; i++ ) {
+        if ( all_int ) {
+            packed_set(packed, i, elements[i].GetInt());
+        } else {
+            packed_set(packed, i, elements[i].GetDouble());
+        }
+    }
+    v = packed;
+    return true;
+}
+
+int pack_arrays( Value &v, int min_len, MemoryPoolAllocator<> &allocator ) {
+    int packed = 0;
+    if ( v.IsObject() ) {
+        for ( Value::MemberIterator itr = v.MemberBegin(); itr != v.MemberEnd(); ++itr ) {
+            packed += pack_arrays(itr->value, min_len, allocator);
+        }
+    } else if ( v.IsArray() ) {
+        if ( (int)v.Size() >= min_len and pack_array(v, allocator) ) {
+            return 1;
+        }
+        for ( Value::ValueIterator e = v.Begin(); e != v.End(); ++e ) {
+            packed += pack_arrays(*e, min_len, allocator);
+        }
+    }
+    return packed;
+}
+
+void unpack_array( Value &v, MemoryPoolAllocator<> &allocator ) {
+    int count = packed_count(v);
+    Value a(kArrayType);
+    a.Reserve(count, allocator);
+    for ( int i = 0; i < count; i++ ) {
+        Value e;
+        if ( packed_type(v) == PACKED_INT ) {
+            e.SetInt(packed_get<int>(v, i));
+        } else {
+            e.SetDouble(packed_get<double>(v, i));
+        }
+        a.PushBack(e, allocator);
+    }
+    v = a;
+}
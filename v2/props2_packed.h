@@ -0,0 +1,181 @@
+#pragma once
+
+// Packed numeric arrays for the v2 property tree.
+//
+// A homogeneous numeric array can be stored as one contiguous block of
+// double or int32 elements instead of a json array of tagged
+// Values (16 bytes per element).  The block lives in a string Value so
+// the tree owns and moves it like any other leaf.  It starts with a
+// header (leading nul, magic, type, element count) and its length must
+// match that count, and it is padded so it is never stored inline as a
+// short string, which keeps the element data 8 byte aligned.  Json text
+// can spell such a string ("\u0000PK..."), so strings that would read as
+// packed storage are refused wherever they enter a tree (loaded text,
+// binary images, setString().)  Packed arrays are
+// expanded back into regular json arrays whenever the tree is written
+// out, so they are invisible outside of the tree.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rapidjson/document.h"
+using namespace rapidjson;
+
+// (floats are stored as doubles, as they are in a regular array)
+enum PackedType {
+    PACKED_DOUBLE = 'd',
+    PACKED_INT = 'i'
+};
+
+struct PackedHeader {
+    char magic[3];              // "\0PK"
+    char type;                  // PackedType
+    uint32_t count;             // number of elements
+};
+
+static const SizeType packed_min_payload = 16;
+
+static inline int packed_element_size(char type) {
+    return type == PACKED_DOUBLE ? sizeof(double) : sizeof(int32_t);
+}
+
+static inline SizeType packed_length(char type, int count) {
+    SizeType payload = count * packed_element_size(type);
+    if ( payload < packed_min_payload ) {
+        payload = packed_min_payload;
+    }
+    return sizeof(PackedHeader) + payload;
+}
+
+static inline const PackedHeader *packed_header(const Value &v) {
+    return (const PackedHeader *)v.GetString();
+}
+
+static inline bool is_packed(const Value &v) {
+    if ( !v.IsString() or v.GetStringLength() < sizeof(PackedHeader) ) {
+        return false;
+    }
+    // any string can get here (in situ strings aren't even aligned), so
+    // check the magic bytewise before looking at the header
+    const char *str = v.GetString();
+    if ( str[0] != 0 or str[1] != 'P' or str[2] != 'K' ) {
+        return false;
+    }
+    PackedHeader h;
+    memcpy(&h, str, sizeof(h));
+    return (h.type == PACKED_DOUBLE or h.type == PACKED_INT)
+        and v.GetStringLength() == packed_length(h.type, h.count);
+}
+
+static inline int packed_count(const Value &v) {
+    return packed_header(v)->count;
+}
+
+static inline char packed_type(const Value &v) {
+    return packed_header(v)->type;
+}
+
+// element storage (the block is allocator owned so writable in place)
+static inline void *packed_data(Value &v) {
+    return (char *)v.GetString() + sizeof(PackedHeader);
+}
+
+// element i converted to T
+template <typename T>
+static inline T packed_get(Value &v, int i) {
+    const void *data = packed_data(v);
+    switch ( packed_type(v) ) {
+    case PACKED_DOUBLE: return ((const double *)data)[i];
+    default: return ((const int32_t *)data)[i];
+    }
+}
+
+// store x (converted to the element type) in element i
+template <typename T>
+static inline void packed_set(Value &v, int i, T x) {
+    void *data = packed_data(v);
+    switch ( packed_type(v) ) {
+    case PACKED_DOUBLE: ((double *)data)[i] = x; break;
+    default: ((int32_t *)data)[i] = x; break;
+    }
+}
+
+// copy the first n elements out converted to T (one type dispatch,
+// then a plain loop the compiler can vectorize)
+template <typename T>
+static inline void packed_read(Value &v, T *dst, int n) {
+    const void *data = packed_data(v);
+    switch ( packed_type(v) ) {
+    case PACKED_DOUBLE:
+        for ( int i = 0; i < n; i++ ) dst[i] = ((const double *)data)[i];
+        break;
+    default:
+        for ( int i = 0; i < n; i++ ) dst[i] = ((const int32_t *)data)[i];
+        break;
+    }
+}
+
+// make v a zero filled packed array of count elements
+void make_packed( Value &v, char type, int count,
+                  MemoryPoolAllocator<> &allocator );
+
+// true if any string under v would read as packed storage (checked
+// before anything under v is packed)
+bool contains_packed( const Value &v );
+
+// convert a regular json array to packed storage, fails (leaving v
+// alone) unless every element is a number, ints are packed as int32 if
+// they all fit, otherwise elements are packed as doubles
+bool pack_array( Value &v, MemoryPoolAllocator<> &allocator );
+
+// pack every qualifying array of at least min_len elements under v,
+// returns the number of arrays packed
+int pack_arrays( Value &v, int min_len, MemoryPoolAllocator<> &allocator );
+
+// convert packed storage back to a regular json array
+void unpack_array( Value &v, MemoryPoolAllocator<> &allocator );
+
+// Handler adaptor for Value::Accept(): forwards everything to the
+// wrapped writer but emits packed arrays as plain json arrays.
+template <typename Handler>
+class PackedExpander {
+public:
+    PackedExpander(Handler &h): handler(h) {}
+
+    bool Null() { return handler.Null(); }
+    bool Bool(bool b) { return handler.Bool(b); }
+    bool Int(int i) { return handler.Int(i); }
+    bool Uint(unsigned u) { return handler.Uint(u); }
+    bool Int64(int64_t i) { return handler.Int64(i); }
+    bool Uint64(uint64_t u) { return handler.Uint64(u); }
+    bool Double(double d) { return handler.Double(d); }
+    bool RawNumber(const char *str, SizeType len, bool copy) {
+        return handler.RawNumber(str, len, copy);
+    }
+    bool String(const char *str, SizeType len, bool copy) {
+        Value ref(StringRef(str, len));
+        if ( !is_packed(ref) ) {
+            return handler.String(str, len, copy);
+        }
+        int count = packed_count(ref);
+        bool ok = handler.StartArray();
+        for ( int i = 0; ok and i < count; i++ ) {
+            if ( packed_type(ref) == PACKED_INT ) {
+                ok = handler.Int(packed_get<int>(ref, i));
+            } else {
+                ok = handler.Double(packed_get<double>(ref, i));
+            }
+        }
+        return ok and handler.EndArray(count);
+    }
+    bool StartObject() { return handler.StartObject(); }
+    bool Key(const char *str, SizeType len, bool copy) {
+        return handler.Key(str, len, copy);
+    }
+    bool EndObject(SizeType count) { return handler.EndObject(count); }
+    bool StartArray() { return handler.StartArray(); }
+    bool EndArray(SizeType count) { return handler.EndArray(count); }
+
+private:
+    Handler &handler;
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+// File access wrappers (posix or AP_Filesystem) and file descriptor
+// streams for rapidjson (FileReadStream needs a FILE*, which
+// AP_Filesystem doesn't provide.)  Files of any size are read and
+// written through a small caller supplied buffer.
+
+#if defined(ARDUPILOT_BUILD)
+#  include <AP_Filesystem/AP_Filesystem.h>
+#else
+#  include <fcntl.h>            // open()
+#  include <sys/stat.h>         // stat()
+#  include <stdio.h>            // rename()
+#  include <unistd.h>           // read(), write(), fsync(), close()
+#endif
+
+#include <stddef.h>
+
+#include "rapidjson/rapidjson.h"
+
+static inline int props2_open(const char *path, int flags) {
+#if defined(ARDUPILOT_BUILD)
+    return AP::FS().open(path, flags);
+#else
+    return open(path, flags, 0644);
+#endif
+}
+
+static inline ssize_t props2_read(int fd, void *buf, size_t count) {
+#if defined(ARDUPILOT_BUILD)
+    return AP::FS().read(fd, buf, count);
+#else
+    return read(fd, buf, count);
+#endif
+}
+
+static inline ssize_t props2_write(int fd, const void *buf, size_t count) {
+#if defined(ARDUPILOT_BUILD)
+    return AP::FS().write(fd, buf, count);
+#else
+    return write(fd, buf, count);
+#endif
+}
+
+static inline int props2_rename(const char *oldpath, const char *newpath) {
+#if defined(ARDUPILOT_BUILD)
+    return AP::FS().rename(oldpath, newpath);
+#else
+    return rename(oldpath, newpath);
+#endif
+}
+
+static inline int props2_unlink(const char *path) {
+#if defined(ARDUPILOT_BUILD)
+    return AP::FS().unlink(path);
+#else
+    return unlink(path);
+#endif
+}
+
+static inline int props2_stat(const char *path, struct stat *st) {
+#if defined(ARDUPILOT_BUILD)
+    return AP::FS().stat(path, st);
+#else
+    return stat(path, st);
+#endif
+}
+
+static inline int props2_fsync(int fd) {
+#if defined(ARDUPILOT_BUILD)
+    return AP::FS().fsync(fd) ? 0 : -1;
+#else
+    return fsync(fd);
+#endif
+}
+
+static inline int props2_close(int fd) {
+#if defined(ARDUPILOT_BUILD)
+    return AP::FS().close(fd);
+#else
+    return close(fd);
+#endif
+}
+
+// rapidjson input stream reading from an open file descriptor, same
+// behavior as rapidjson::FileReadStream (a nul is returned at the end of
+// the file.)  A read error also ends the stream, check error() after
+// parsing.
+class FdReadStream {
+public:
+    typedef char Ch;
+
+    FdReadStream(int fd, char *buffer, size_t buffer_size):
+        fd(fd), buffer(buffer), buffer_size(buffer_size)
+    {
+        RAPIDJSON_ASSERT(buffer_size >= 4);
+        current = buffer;
+        fill();
+    }
+
+    Ch Peek() const { return *current; }
+    Ch Take() {
+        Ch c = *current;
+        if ( current < last ) {
+            current++;
+        } else {
+            fill();
+        }
+        return c;
+    }
+    size_t Tell() const { return count + (current - buffer); }
+    bool error() const { return read_error; }
+
+    // not an output stream
+    void Put(Ch) { RAPIDJSON_ASSERT(false); }
+    void Flush() { RAPIDJSON_ASSERT(false); }
+    Ch *PutBegin() { RAPIDJSON_ASSERT(false); return 0; }
+    size_t PutEnd(Ch *) { RAPIDJSON_ASSERT(false); return 0; }
+
+private:
+    void fill() {
+        if ( eof ) {
+            return;
+        }
+        count += read_count;
+        ssize_t n = props2_read(fd, buffer, buffer_size - 1);
+        if ( n < 0 ) {
+            read_error = true;
+            n = 0;
+        }
+        read_count = n;
+        current = buffer;
+        if ( n > 0 ) {
+            last = buffer + read_count - 1;
+        } else {
+            buffer[0] = 0;
+            last = buffer;
+            eof = true;
+        }
+    }
+
+    int fd;
+    Ch *buffer;
+    size_t buffer_size;
+    Ch *current = nullptr;
+    Ch *last = nullptr;
+    size_t read_count = 0;      // bytes in the buffer
+    size_t count = 0;           // bytes consumed before the buffer
+    bool eof = false;
+    bool read_error = false;
+};
+
+// rapidjson output stream writing to an open file descriptor through
+// the buffer, flushed when full (and by the writer at the end of the
+// document.)  A write error drops the rest of the output, check error()
+// after writing.
+class FdWriteStream {
+public:
+    typedef char Ch;
+
+    FdWriteStream(int fd, char *buffer, size_t buffer_size):
+        fd(fd), buffer(buffer), end(buffer + buffer_size), current(buffer)
+    {
+        RAPIDJSON_ASSERT(buffer_size >= 4);
+    }
+
+    void Put(Ch c) {
+        if ( current == end ) {
+            Flush();
+        }
+        *current++ = c;
+    }
+    void Flush() {
+        const char *p = buffer;
+        while ( p < current and !write_error ) {
+            ssize_t n = props2_write(fd, p, current - p);
+            if ( n <= 0 ) {
+                write_error = true;
+            } else {
+                p += n;
+                count += n;
+            }
+        }
+        current = buffer;
+    }
+    size_t Tell() const { return count + (current - buffer); }
+    bool error() const { return write_error; }
+
+    // not an input stream
+    Ch Peek() const { RAPIDJSON_ASSERT(false); return 0; }
+    Ch Take() { RAPIDJSON_ASSERT(false); return 0; }
+    Ch *PutBegin() { RAPIDJSON_ASSERT(false); return 0; }
+    size_t PutEnd(Ch *) { RAPIDJSON_ASSERT(false); return 0; }
+
+private:
+    int fd;
+    Ch *buffer;
+    Ch *end;
+    Ch *current;
+    size_t count = 0;           // bytes written out
+    bool write_error = false;
+};
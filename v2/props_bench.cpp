@@ -0,0 +1,796 @@
+// micro benchmarks for the v2 property tree
+//
+// build: g++ -O2 -DNDEBUG -I<path to rapidjson/include> props2.cpp
+//            props2_binary.cpp props2_log.cpp props2_packed.cpp
+//            props_bench.cpp -lpthread
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <new>
+#include <thread>
+
+#include "props2.h"
+#include "props2_packed.h"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+// count heap allocations made through operator new (std::string,
+// std::vector, etc.)
+static unsigned long alloc_count = 0;
+
+void *operator new(size_t size) {
+    alloc_count++;
+    void *p = malloc(size ? size : 1);
+    if ( p == nullptr ) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t size) noexcept {
+    free(p);
+}
+
+static double get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void report(const char *name, int count, double elapsed,
+                   unsigned long allocs)
+{
+    printf("%-40s %10.1f ns/op %8.2f allocs/op\n", name,
+           elapsed * 1000000000.0 / count, (double)allocs / count);
+}
+
+// redirect stdout to a temp file so we can count what gets written
+static int stdout_save = -1;
+static int stdout_capture = -1;
+
+static void begin_stdout_capture() {
+    fflush(stdout);
+    char name[] = "/tmp/props_bench_XXXXXX";
+    stdout_capture = mkstemp(name);
+    unlink(name);
+    stdout_save = dup(1);
+    dup2(stdout_capture, 1);
+}
+
+static long end_stdout_capture() {
+    fflush(stdout);
+    long bytes = lseek(stdout_capture, 0, SEEK_END);
+    dup2(stdout_save, 1);
+    close(stdout_save);
+    close(stdout_capture);
+    return bytes;
+}
+
+// resolve paths that already exist in the tree
+static void bench_path_lookup() {
+    const int count = 100000;
+    for ( int i = 0; i < 4; i++ ) {
+        PropertyNode imu_node("/sensors/imu/" + std::to_string(i), true);
+        imu_node.setDouble("az", -9.81);
+    }
+    PropertyNode("/sensors/imu/2/az", true);
+
+    unsigned long allocs = alloc_count;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        PropertyNode node("/sensors/imu/2/az", false);
+    }
+    report("PropertyNode(\"/sensors/imu/2/az\")", count, get_time() - start,
+           alloc_count - allocs);
+
+    PropertyNode sensors_node("/sensors", false);
+    allocs = alloc_count;
+    start = get_time();
+    int sink = 0;
+    for ( int i = 0; i < count; i++ ) {
+        PropertyNode node = sensors_node.getChild("imu/2", false);
+        sink += node.isNull();
+    }
+    report("getChild(\"imu/2\")", count, get_time() - start,
+           alloc_count - allocs);
+    if ( sink != 0 ) {
+        printf("(unexpected null child)\n");
+    }
+
+    PropertyPath az_path("/sensors/imu/2/az");
+    allocs = alloc_count;
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        PropertyNode node(az_path, false);
+    }
+    report("PropertyNode(PropertyPath)", count, get_time() - start,
+           alloc_count - allocs);
+
+    // path construction (existing and new paths) should not touch stdio
+    begin_stdout_capture();
+    for ( int i = 0; i < count; i++ ) {
+        PropertyNode node("/sensors/imu/2/az", true);
+    }
+    PropertyNode("/sensors/imu/12/new/path", true);
+    long bytes = end_stdout_capture();
+    printf("%-40s %10ld bytes written to stdout\n", "path construction",
+           bytes);
+}
+
+// member access on a wide (flat parameter table style) object
+static void bench_wide_object() {
+    const int count = 100000;
+    const int width = 500;
+    PropertyNode table_node("/config/params", true);
+    vector<string> names;
+    for ( int i = 0; i < width; i++ ) {
+        names.push_back("param_" + std::to_string(i));
+        table_node.setDouble(names[i].c_str(), i);
+    }
+
+    unsigned long allocs = alloc_count;
+    double sum = 0.0;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        sum += table_node.getDouble(names[i % width].c_str());
+    }
+    report("getDouble() on 500 member object", count, get_time() - start,
+           alloc_count - allocs);
+
+    allocs = alloc_count;
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        table_node.setDouble(names[i % width].c_str(), i);
+    }
+    report("setDouble() on 500 member object", count, get_time() - start,
+           alloc_count - allocs);
+}
+
+// bound leaf handles vs. by name access
+static void bench_leaf_handles() {
+    const int count = 1000000;
+    PropertyNode imu_node("/sensors/imu/2", true);
+    imu_node.setDouble("az", -9.81);
+
+    double sum = 0.0;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        sum += imu_node.getDouble("az");
+    }
+    report("getDouble(\"az\")", count, get_time() - start, 0);
+
+    PropertyLeaf<double> az = imu_node.bindDouble("az");
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        sum += az.get();
+    }
+    report("PropertyLeaf<double>::get()", count, get_time() - start, 0);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        imu_node.setDouble("az", i);
+    }
+    report("setDouble(\"az\")", count, get_time() - start, 0);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        az.set(i);
+    }
+    report("PropertyLeaf<double>::set()", count, get_time() - start, 0);
+
+    PropertyNode::setStableHandles(false);
+    PropertyNode raw_node("/sensors/imu/2", true);
+    PropertyLeaf<double> raw_az = raw_node.bindDouble("az");
+    PropertyNode::setStableHandles(true);
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        sum += raw_az.get();
+    }
+    report("PropertyLeaf<double>::get() (raw)", count, get_time() - start, 0);
+    if ( sum == 0.0 ) {
+        printf("(unexpected sum)\n");
+    }
+}
+
+// per element vs. bulk array transfer
+static void bench_arrays() {
+    const int count = 100000;
+    const int len = 64;
+    double spectrum[len];
+    for ( int i = 0; i < len; i++ ) {
+        spectrum[i] = i * 0.25;
+    }
+    PropertyNode fft_node("/sensors/fft", true);
+    fft_node.setDoubleArray("spectrum", spectrum, len);
+
+    double sum = 0.0;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        for ( int j = 0; j < len; j++ ) {
+            sum += fft_node.getDouble("spectrum", j);
+        }
+    }
+    report("getDouble(name, i) x64", count, get_time() - start, 0);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        fft_node.getDoubleArray("spectrum", spectrum, len);
+        sum += spectrum[i % len];
+    }
+    report("getDoubleArray() x64", count, get_time() - start, 0);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        for ( int j = 0; j < len; j++ ) {
+            fft_node.setFloat("spectrum", j, spectrum[j]);
+        }
+    }
+    report("setFloat(name, i, x) x64", count, get_time() - start, 0);
+
+    unsigned long allocs = alloc_count;
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        fft_node.setDoubleArray("spectrum", spectrum, len);
+    }
+    report("setDoubleArray() x64", count, get_time() - start,
+           alloc_count - allocs);
+
+    // same table in packed storage
+    size_t pool = doc.GetAllocator().Size();
+    fft_node.setDoubleArray("generic", spectrum, len);
+    size_t generic_bytes = doc.GetAllocator().Size() - pool;
+    pool = doc.GetAllocator().Size();
+    fft_node.packArray("spectrum");
+    size_t packed_bytes = doc.GetAllocator().Size() - pool;
+    printf("%-40s %10d bytes generic %6d bytes packed\n", "64 double table",
+           (int)generic_bytes, (int)packed_bytes);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        fft_node.getDoubleArray("spectrum", spectrum, len);
+        sum += spectrum[i % len];
+    }
+    report("getDoubleArray() x64 (packed)", count, get_time() - start, 0);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        fft_node.setDoubleArray("spectrum", spectrum, len);
+    }
+    report("setDoubleArray() x64 (packed)", count, get_time() - start, 0);
+    if ( sum == 0.0 ) {
+        printf("(unexpected sum)\n");
+    }
+}
+
+// numeric reads of string valued leaves
+static void bench_numeric_strings() {
+    const int count = 1000000;
+    PropertyNode imu_node("/sensors/imu/3", true);
+    imu_node.setString("az", "-9.8092322");
+    imu_node.setDouble("ax", -9.8092322);
+
+    double sum = 0.0;
+    unsigned long allocs = alloc_count;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        sum += imu_node.getDouble("az");
+    }
+    report("getDouble() on string leaf", count, get_time() - start,
+           alloc_count - allocs);
+
+    allocs = alloc_count;
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        sum += imu_node.getInt("az");
+    }
+    report("getInt() on string leaf", count, get_time() - start,
+           alloc_count - allocs);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        sum += imu_node.getDouble("ax");
+    }
+    report("getDouble() on double leaf", count, get_time() - start, 0);
+    if ( sum == 0.0 ) {
+        printf("(unexpected sum)\n");
+    }
+}
+
+// per frame status strings: heap allocations and pool growth
+static void bench_string_leaves() {
+    const int count = 1000000;
+    PropertyNode link_node("/bench/link", true);
+    char status[64];
+    size_t pool = doc.GetAllocator().Size();
+    unsigned long allocs = alloc_count;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        snprintf(status, sizeof(status), "connected, packet %d", i);
+        link_node.setString("status", status);
+        link_node.setString("mode", i % 2 ? "auto" : "manual");
+    }
+    report("setString() status + mode", count, get_time() - start,
+           alloc_count - allocs);
+    printf("%-40s %10d bytes\n", "pool growth",
+           (int)(doc.GetAllocator().Size() - pool));
+}
+
+// fan-in read of enumerated devices: by hand vs. a bound query
+static void bench_query() {
+    const int count = 100000;
+    const int devices = 8;
+    for ( int i = 0; i < devices; i++ ) {
+        PropertyNode("/bench/imu/" + std::to_string(i), true)
+            .setDouble("az", -9.81);
+    }
+    double az[devices];
+    double sum = 0.0;
+
+    unsigned long allocs = alloc_count;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        int n = PropertyNode("/bench").getLen("imu");
+        for ( int j = 0; j < n and j < devices; j++ ) {
+            PropertyNode node("/bench/imu/" + std::to_string(j), true);
+            az[j] = node.getDouble("az");
+        }
+        sum += az[i % devices];
+    }
+    report("path strings + getDouble() x8", count, get_time() - start,
+           alloc_count - allocs);
+
+    PropertyQuery query = PropertyNode("/").query("/bench/imu/*/az");
+    allocs = alloc_count;
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        query.getDoubles(az, devices);
+        sum += az[i % devices];
+    }
+    report("query getDoubles() x8", count, get_time() - start,
+           alloc_count - allocs);
+    if ( sum == 0.0 ) {
+        printf("(unexpected sum)\n");
+    }
+}
+
+// generic logger walk: child names as strings vs. visited in place
+static void bench_visit() {
+    const int count = 100;
+    const int devices = 100;
+    const int leaves = 30;
+    for ( int i = 0; i < devices; i++ ) {
+        PropertyNode node("/bench/devices/dev" + std::to_string(i), true);
+        for ( int j = 0; j < leaves; j++ ) {
+            node.setDouble(("v" + std::to_string(j)).c_str(), j);
+        }
+    }
+    PropertyNode devices_node("/bench/devices");
+    double sum = 0.0;
+
+    unsigned long allocs = alloc_count;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        vector<string> names = devices_node.getChildren();
+        for ( unsigned int j = 0; j < names.size(); j++ ) {
+            PropertyNode dev = devices_node.getChild(names[j].c_str());
+            vector<string> fields = dev.getChildren();
+            for ( unsigned int k = 0; k < fields.size(); k++ ) {
+                sum += dev.getDouble(fields[k].c_str());
+            }
+        }
+    }
+    report("getChildren() walk x3000 leaves", count, get_time() - start,
+           alloc_count - allocs);
+
+    auto leaf_visit = [&sum](PropertyChild &child) {
+        sum += getValueAsDouble(*child.node.get_valptr());
+        return true;
+    };
+    auto dev_visit = [&leaf_visit](PropertyChild &child) {
+        child.node.visitChildren(leaf_visit);
+        return true;
+    };
+    allocs = alloc_count;
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        devices_node.visitChildren(dev_visit);
+    }
+    report("visitChildren() walk x3000 leaves", count, get_time() - start,
+           alloc_count - allocs);
+
+    // the same walk through std::function wrappers, for comparison
+    std::function<bool(PropertyChild &)> leaf_fn = leaf_visit;
+    std::function<bool(PropertyChild &)> dev_fn = [&leaf_fn](PropertyChild &child) {
+        child.node.visitChildren(leaf_fn);
+        return true;
+    };
+    allocs = alloc_count;
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        devices_node.visitChildren(dev_fn);
+    }
+    report("visitChildren() std::function walk", count, get_time() - start,
+           alloc_count - allocs);
+    if ( sum == 0.0 ) {
+        printf("(unexpected sum)\n");
+    }
+}
+
+// write a config file of about size bytes (nested sensor style objects)
+static void make_config(const char *path, long size) {
+    FILE *fp = fopen(path, "w");
+    fprintf(fp, "{\n");
+    long written = 0;
+    for ( int i = 0; written < size; i++ ) {
+        written += fprintf(fp, "%s  \"node%d\": { \"name\": \"sensor %d\", "
+                           "\"enable\": true, \"rate_hz\": %d, "
+                           "\"scale\": %.6f, \"offset\": [%.3f, %.3f, %.3f], "
+                           "\"calib\": { \"a\": %.6f, \"b\": %.6f } }\n",
+                           i ? "," : "", i, i, 50 + i % 400, i * 0.001,
+                           i * 0.1, -i * 0.1, i * 0.01, i * 1e-5, -i * 1e-5);
+    }
+    fprintf(fp, "}\n");
+    fclose(fp);
+}
+
+// load time and tree memory growth vs. file size
+static void bench_load(const char *name, long size, unsigned int flags) {
+    const char *path = "/tmp/props_bench_load.json";
+    make_config(path, size);
+    FILE *fp = fopen(path, "r");
+    fseek(fp, 0, SEEK_END);
+    long file_size = ftell(fp);
+    fclose(fp);
+
+    size_t pool = doc.GetAllocator().Size();
+    double start = get_time();
+    PropertyNode node(string("/bench/") + name, true);
+    bool ok = node.load(path, flags);
+    double elapsed = get_time() - start;
+    size_t tree_bytes = doc.GetAllocator().Size() - pool;
+    printf("%-40s %10.1f ms %8.1f MB/s  tree %.2fx file%s\n", name,
+           elapsed * 1000.0, file_size / elapsed / 1000000.0,
+           (double)tree_bytes / file_size, ok ? "" : " (failed)");
+    unlink(path);
+}
+
+// startup with a root config fanning out into include files, serial vs.
+// parallel include expansion
+static void bench_includes(int num_files, long file_size) {
+    char path[64];
+    const char *root_path = "/tmp/props_bench_root.json";
+    FILE *fp = fopen(root_path, "w");
+    fprintf(fp, "{\n");
+    for ( int i = 0; i < num_files; i++ ) {
+        snprintf(path, sizeof(path), "/tmp/props_bench_inc%d.json", i);
+        make_config(path, file_size);
+        fprintf(fp, "%s  \"module%d\": { \"include\": \"%s\" }\n",
+                i ? "," : "", i, path);
+    }
+    fprintf(fp, "}\n");
+    fclose(fp);
+
+    const char *names[2] = { "serial includes", "parallel includes" };
+    unsigned int flags[2] = { 0, PROPS2_LOAD_PARALLEL_INCLUDES };
+    for ( int j = 0; j < 2; j++ ) {
+        PropertyNode node(string("/bench/includes") + std::to_string(j), true);
+        double start = get_time();
+        node.load(root_path, flags[j]);
+        char name[64];
+        snprintf(name, sizeof(name), "%s (%d x %ldKB)", names[j], num_files,
+                 file_size / 1000);
+        printf("%-40s %10.1f ms\n", name, (get_time() - start) * 1000.0);
+    }
+    for ( int i = 0; i < num_files; i++ ) {
+        snprintf(path, sizeof(path), "/tmp/props_bench_inc%d.json", i);
+        unlink(path);
+    }
+    unlink(root_path);
+}
+
+// startup through the binary config cache: cold (parse and write the
+// cache) then warm (cache only)
+static void bench_cache(const char *name, long size) {
+    const char *path = "/tmp/props_bench_cached.json";
+    const char *cache_path = "/tmp/props_bench_cached.json.cache";
+    make_config(path, size);
+    struct utimbuf times;
+    times.actime = times.modtime = time(nullptr) - 10;
+    utime(path, &times);
+    unlink(cache_path);
+
+    const char *runs[2] = { "cold", "warm" };
+    for ( int j = 0; j < 2; j++ ) {
+        PropertyNode node(string("/bench/cached") + runs[j], true);
+        double start = get_time();
+        node.load(path, PROPS2_LOAD_USE_CACHE);
+        char label[64];
+        snprintf(label, sizeof(label), "%s (cache %s)", name, runs[j]);
+        printf("%-40s %10.1f ms\n", label, (get_time() - start) * 1000.0);
+    }
+    unlink(path);
+    unlink(cache_path);
+}
+
+// binary vs. json snapshots of a loaded config
+static void bench_binary() {
+    const char *path = "/tmp/props_bench_binary.json";
+    make_config(path, 1000000);
+    PropertyNode node("/bench/binary", true);
+    node.load(path);
+    unlink(path);
+
+    double start = get_time();
+    StringBuffer pretty;
+    PrettyWriter<StringBuffer> pretty_writer(pretty);
+    PackedExpander< PrettyWriter<StringBuffer> > pretty_expander(pretty_writer);
+    node.get_valptr()->Accept(pretty_expander);
+    printf("%-40s %10.1f ms %10d bytes\n", "snapshot as pretty json",
+           (get_time() - start) * 1000.0, (int)pretty.GetSize());
+
+    start = get_time();
+    StringBuffer compact;
+    Writer<StringBuffer> compact_writer(compact);
+    PackedExpander< Writer<StringBuffer> > compact_expander(compact_writer);
+    node.get_valptr()->Accept(compact_expander);
+    printf("%-40s %10.1f ms %10d bytes\n", "snapshot as compact json",
+           (get_time() - start) * 1000.0, (int)compact.GetSize());
+
+    // streamed to a file: allocations don't grow with the tree
+    const char *save_path = "/tmp/props_bench_save.json";
+    unsigned long allocs = alloc_count;
+    start = get_time();
+    node.save(save_path, PROPS2_SAVE_PRETTY);
+    printf("%-40s %10.1f ms %10lu allocs\n", "save() pretty json",
+           (get_time() - start) * 1000.0, alloc_count - allocs);
+    allocs = alloc_count;
+    start = get_time();
+    node.save(save_path, PROPS2_SAVE_COMPACT);
+    printf("%-40s %10.1f ms %10lu allocs\n", "save() compact json",
+           (get_time() - start) * 1000.0, alloc_count - allocs);
+    unlink(save_path);
+
+    string bin;
+    start = get_time();
+    node.writeBinary(bin);
+    printf("%-40s %10.1f ms %10d bytes\n", "snapshot as binary",
+           (get_time() - start) * 1000.0, (int)bin.length());
+
+    start = get_time();
+    Document json_doc;
+    json_doc.Parse(compact.GetString());
+    printf("%-40s %10.1f ms\n", "parse compact json snapshot",
+           (get_time() - start) * 1000.0);
+
+    start = get_time();
+    PropertyNode("/bench/binary_copy", true).readBinary(bin.data(), bin.length());
+    printf("%-40s %10.1f ms\n", "decode binary snapshot",
+           (get_time() - start) * 1000.0);
+}
+
+// per frame telemetry: serialize the whole subtree vs. find the deltas
+static void bench_changes() {
+    const int count = 1000;
+    const int nodes = 100;
+    const int leaves = 10;
+    vector<PropertyLeaf<double> > handles;
+    for ( int i = 0; i < nodes; i++ ) {
+        PropertyNode n("/bench/telemetry/dev" + std::to_string(i), true);
+        for ( int j = 0; j < leaves; j++ ) {
+            handles.push_back(n.bindDouble(("ch" + std::to_string(j)).c_str()));
+        }
+    }
+    PropertyNode node("/bench/telemetry", true);
+
+    size_t bytes = 0;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        handles[(i * 7) % handles.size()].set(i);
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        node.get_valptr()->Accept(writer);
+        bytes += buffer.GetSize();
+    }
+    report("full telemetry frame (1000 leaves)", count, get_time() - start, 0);
+
+    uint64_t frame = PropertyNode::getGeneration();
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        for ( int j = 0; j < 5; j++ ) {
+            handles[(i * 7 + j * 131) % handles.size()].set(i);
+        }
+        bytes += node.getChangedSince(frame).size();
+        frame = PropertyNode::getGeneration();
+    }
+    report("changed leaves frame (5 of 1000)", count, get_time() - start, 0);
+    if ( bytes == 0 ) {
+        printf("(unexpected size)\n");
+    }
+}
+
+// detecting rare changes: poll 50 leaves by name vs. dispatch()
+static void bench_subscriptions() {
+    const int count = 100000;
+    const int watched = 50;
+    PropertyNode node("/bench/modes", true);
+    vector<string> names;
+    int calls = 0;
+    for ( int i = 0; i < watched; i++ ) {
+        names.push_back("mode" + std::to_string(i));
+        node.setInt(names[i].c_str(), 0);
+        node.subscribe(names[i].c_str(), [&calls](const string &) { calls++; });
+    }
+    PropertyNode::dispatch();
+
+    vector<int> last(watched, 0);
+    int changes = 0;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        for ( int j = 0; j < watched; j++ ) {
+            int mode = node.getInt(names[j].c_str());
+            if ( mode != last[j] ) {
+                last[j] = mode;
+                changes++;
+            }
+        }
+    }
+    report("poll 50 leaves for changes", count, get_time() - start, 0);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        calls += PropertyNode::dispatch();
+    }
+    report("dispatch() 50 subscriptions", count, get_time() - start, 0);
+    if ( changes + calls != 0 ) {
+        printf("(unexpected changes)\n");
+    }
+}
+
+// uncontended cost of the locks in concurrency mode
+static void bench_concurrent() {
+    const int count = 1000000;
+    PropertyNode imu_node("/sensors/imu/2", true);
+    PropertyLeaf<double> az = imu_node.bindDouble("az");
+    PropertyNode::setConcurrent(true);
+
+    double sum = 0.0;
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        sum += imu_node.getDouble("az");
+    }
+    report("getDouble(\"az\") (concurrent)", count, get_time() - start, 0);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        imu_node.setDouble("az", i);
+    }
+    report("setDouble(\"az\") (concurrent)", count, get_time() - start, 0);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        sum += az.get();
+    }
+    report("PropertyLeaf<double>::get() (concurrent)", count, get_time() - start, 0);
+
+    start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        az.set(i);
+    }
+    report("PropertyLeaf<double>::set() (concurrent)", count, get_time() - start, 0);
+    PropertyNode::setConcurrent(false);
+    if ( sum == 0.0 ) {
+        printf("(unexpected sum)\n");
+    }
+}
+
+// one simulation step per iteration on each of several worker threads:
+// every worker with its own tree, then all of them sharing the default
+// tree in concurrency mode (ns/op is wall time over all workers' steps)
+static void bench_trees() {
+    const int count = 1000000;
+    int nworkers = std::thread::hardware_concurrency();
+    if ( nworkers < 2 ) {
+        nworkers = 2;
+    }
+    for ( int shared = 0; shared < 2; shared++ ) {
+        vector<PropertyTree *> trees;
+        vector<PropertyNode> nodes;
+        vector< PropertyLeaf<double> > alts;
+        for ( int t = 0; t < nworkers; t++ ) {
+            PropertyTree *tree = PropertyTree::getDefault();
+            if ( !shared ) {
+                tree = new PropertyTree;
+                trees.push_back(tree);
+            }
+            PropertyNode node(tree, "/bench/sim/" + std::to_string(t), true);
+            node.setDouble("rate", 0.5);
+            nodes.push_back(node);
+            alts.push_back(node.bindDouble("alt"));
+        }
+        PropertyNode::setConcurrent(shared);
+        vector<std::thread> threads;
+        double start = get_time();
+        for ( int t = 0; t < nworkers; t++ ) {
+            threads.push_back(std::thread([&nodes, &alts, t, count]() {
+                for ( int i = 0; i < count; i++ ) {
+                    alts[t].set(alts[t].get() + nodes[t].getDouble("rate"));
+                }
+            }));
+        }
+        for ( int t = 0; t < nworkers; t++ ) {
+            threads[t].join();
+        }
+        double elapsed = get_time() - start;
+        PropertyNode::setConcurrent(false);
+        report(shared ? "sim step (shared tree, concurrent)"
+                      : "sim step (tree per thread)",
+               count * nworkers, elapsed, 0);
+        for ( int t = 0; t < nworkers; t++ ) {
+            if ( alts[t].get() != count * 0.5 ) {
+                printf("(unexpected result)\n");
+            }
+        }
+        alts.clear();
+        nodes.clear();
+        for ( unsigned int t = 0; t < trees.size(); t++ ) {
+            delete trees[t];
+        }
+    }
+}
+
+// publishing a frame snapshot of the telemetry subtree, and pinning it
+static void bench_snapshots() {
+    const int count = 1000;
+    PropertyNode node("/bench/telemetry", true);
+    double start = get_time();
+    for ( int i = 0; i < count; i++ ) {
+        node.publishSnapshot();
+    }
+    report("publishSnapshot() (1000 leaves)", count, get_time() - start, 0);
+
+    double sum = 0.0;
+    start = get_time();
+    for ( int i = 0; i < count * 100; i++ ) {
+        PropertySnapshot snap("/bench/telemetry");
+        sum += snap.getGeneration();
+    }
+    report("PropertySnapshot pin and release", count * 100,
+           get_time() - start, 0);
+    if ( sum == 0.0 ) {
+        printf("(unexpected sum)\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    bench_path_lookup();
+    bench_wide_object();
+    bench_leaf_handles();
+    bench_concurrent();
+    bench_trees();
+    bench_arrays();
+    bench_numeric_strings();
+    bench_string_leaves();
+    bench_query();
+    bench_visit();
+    bench_load("load 1MB config", 1000000, 0);
+    bench_load("load 1MB config (in situ)", 1000000, PROPS2_LOAD_INSITU);
+    bench_load("load 50MB config", 50000000, 0);
+    bench_load("load 50MB config (in situ)", 50000000, PROPS2_LOAD_INSITU);
+    bench_includes(32, 100000);
+    bench_cache("load 1MB config", 1000000);
+    bench_cache("load 50MB config", 50000000);
+    bench_binary();
+    bench_changes();
+    bench_snapshots();
+    bench_subscriptions();
+}
@@ -1,8 +1,37 @@
 #include "props2.h"
+#include "props2_packed.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
 
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <atomic>
 #include <string>
+#include <thread>
 using std::string;
 
+// compact json text of a node (packed arrays expanded)
+static string json_text(PropertyNode node) {
+    StringBuffer buffer;
+    Writer<StringBuffer> writer(buffer);
+    PackedExpander< Writer<StringBuffer> > expander(writer);
+    node.get_valptr()->Accept(expander);
+    return buffer.GetString();
+}
+
+// write a small json file with an mtime age seconds in the past
+static void write_aged(const char *path, const char *json, int age) {
+    FILE *fp = fopen(path, "w");
+    fprintf(fp, "%s\n", json);
+    fclose(fp);
+    struct utimbuf times;
+    times.actime = times.modtime = time(nullptr) - age;
+    utime(path, &times);
+}
+
 int main(int argc, char **argv) {
     PropertyNode root_node = PropertyNode("/", true);
     PropertyNode t1_node = root_node.getChild("task", true);
@@ -24,6 +53,17 @@ int main(int argc, char **argv) {
     printf("az = %.2f\n", imu_node.getDouble("az"));
     imu_node.setInt("az", -10);
     printf("az = %.2f\n", imu_node.getDouble("az"));
+    PropertyPath imu_path("/sensors/imu/2");
+    PropertyNode imu_node2 = PropertyNode(imu_path);
+    printf("compiled path az = %.2f\n", imu_node2.getDouble("az"));
+    PropertyPath imu2_path("imu/2");
+    printf("compiled child az = %.2f\n",
+           PropertyNode("/sensors").getChild(imu2_path).getDouble("az"));
+    PropertyLeaf<double> az_leaf = imu_node.bindDouble("az");
+    az_leaf.set(-9.75);
+    printf("bound az = %.2f (%.2f)\n", az_leaf.get(), imu_node.getDouble("az"));
+    PropertyLeaf<int> ax_leaf = imu_node.bindInt("ax");
+    printf("bound new ax = %d\n", ax_leaf.get());
     imu_node.setString("az", "-9.8092322");
     printf("az = %.8f\n", imu_node.getDouble("az"));
    
@@ -76,5 +116,874 @@ int main(int argc, char **argv) {
 	printf("sensor child = %s\n", children[i].c_str());
     }
 
+    // wide objects are looked up through a member index
+    PropertyNode table_node = PropertyNode("/config/params", true);
+    for ( int i = 0; i < 100; i++ ) {
+        string name = "p" + std::to_string(i);
+        table_node.setInt(name.c_str(), i);
+    }
+    int errors = 0;
+    for ( int i = 0; i < 100; i++ ) {
+        string name = "p" + std::to_string(i);
+        if ( table_node.getInt(name.c_str()) != i ) {
+            errors++;
+        }
+    }
+    printf("wide object errors = %d has p100 = %d\n", errors,
+           table_node.hasChild("p100"));
+
+    // stable handles: hold nodes and leaves while growing siblings
+    // (relocating the storage they live in)
+    PropertyNode stress_root = PropertyNode("/stress", true);
+    PropertyNode stress_node = PropertyNode("/stress/a", true);
+    PropertyNode elem_node = PropertyNode("/stress/list/3", true);
+    stress_node.setInt("value", 42);
+    elem_node.setInt("value", 43);
+    PropertyLeaf<double> stress_leaf = stress_node.bindDouble("leaf");
+    PropertyLeaf<int> elem_leaf = elem_node.bindInt("count");
+    errors = 0;
+    for ( int i = 0; i < 1000; i++ ) {
+        string name = "sibling" + std::to_string(i);
+        stress_root.setInt(name.c_str(), i);
+        stress_node.setInt(name.c_str(), i);
+        PropertyNode("/stress/list/" + std::to_string(4 + i), true);
+        stress_leaf.set(i * 0.5);
+        elem_leaf.set(i);
+        if ( stress_node.getInt("value") != 42
+             or elem_node.getInt("value") != 43
+             or stress_node.getDouble("leaf") != i * 0.5
+             or elem_node.getInt("count") != i ) {
+            errors++;
+        }
+    }
+    {
+        // a leaf whose parent was replaced reads as 0, sets are ignored
+        PropertyTree gone;
+        PropertyNode imu = PropertyNode(&gone, "/sensors/imu/0", true);
+        imu.setDouble("az", -9.81);
+        PropertyLeaf<double> az = imu.bindDouble("az");
+        PropertyLeaf<int> n = imu.bindInt("n");
+        PropertyNode(&gone, "/sensors").setDouble("imu", 1.0);
+        errors += !az.isNull() + (az.get() != 0.0) + (n.get() != 0);
+        az.set(2.0);
+        n.set(3);
+        errors += (PropertyNode(&gone, "/sensors").getDouble("imu") != 1.0);
+    }
+    printf("stable handle errors = %d\n", errors);
+
+    // bulk array transfer and indexed getters
+    PropertyNode filter_node = PropertyNode("/filters/ekf", true);
+    double R[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    filter_node.setDoubleArray("R", R, 9);
+    float bias[3] = { 0.1, -0.2, 0.3 };
+    filter_node.setFloatArray("bias", bias, 3);
+    int counts[4] = { 1, 2, 3, 4 };
+    filter_node.setIntArray("counts", counts, 4);
+    filter_node.setIntArray("counts", counts, 2);  // shrink
+    double R2[9] = { 0 };
+    int n = filter_node.getDoubleArray("R", R2, 9);
+    errors = (n != 9);
+    for ( int i = 0; i < 9; i++ ) {
+        if ( R2[i] != R[i] or filter_node.getDouble("R", i) != R[i] ) {
+            errors++;
+        }
+    }
+    int counts2[4] = { 0 };
+    errors += (filter_node.getIntArray("counts", counts2, 4) != 2);
+    errors += (filter_node.getLen("counts") != 2);
+    errors += (filter_node.getInt("counts", 1) != 2);
+    errors += (filter_node.getInt("counts", 3) != 0);  // out of range
+    printf("array errors = %d bias[1] = %.2f (%s)\n", errors,
+           filter_node.getFloat("bias", 1),
+           filter_node.getString("bias", 1).c_str());
+
+    // packed arrays: loaded numeric tables are stored contiguously but
+    // read and print like regular arrays
+    const char *cal_file = "/tmp/props_test_cal.json";
+    FILE *fp = fopen(cal_file, "w");
+    fprintf(fp, "{ \"table\": [");
+    for ( int i = 0; i < 32; i++ ) {
+        fprintf(fp, "%s%.2f", i ? ", " : "", i * 0.5);
+    }
+    fprintf(fp, "], \"ids\": [");
+    for ( int i = 0; i < 20; i++ ) {
+        fprintf(fp, "%s%d", i ? ", " : "", i);
+    }
+    fprintf(fp, "], \"short\": [1, 2, 3] }\n");
+    fclose(fp);
+    PropertyNode cal_node = PropertyNode("/config/cal", true);
+    cal_node.load(cal_file);
+    errors = 0;
+    errors += !cal_node.isPacked("table") + !cal_node.isPacked("ids");
+    errors += cal_node.isPacked("short");
+    errors += (cal_node.getLen("table") != 32);
+    errors += (cal_node.getDouble("table", 5) != 2.5);
+    errors += (cal_node.getInt("ids", 7) != 7);
+    double table[32];
+    errors += (cal_node.getDoubleArray("table", table, 32) != 32);
+    errors += (table[31] != 15.5);
+    cal_node.setFloat("table", 1, 100.0);
+    errors += (cal_node.getFloat("table", 1) != 100.0);
+    float ftable[4] = { 1.5, 2.5, 3.5, 4.5 };
+    ftable[0] = 0.1f;
+    cal_node.setFloatArray("ids", ftable, 4);    // re-typed, stays packed
+    errors += (cal_node.getDouble("ids", 0) != (double)0.1f);
+    errors += !cal_node.isPacked("ids") + (cal_node.getLen("ids") != 4);
+    errors += (PropertyNode("/config/cal/ids/2").isNull());  // unpacks
+    errors += cal_node.isPacked("ids") + (cal_node.getDouble("ids", 3) != 4.5);
+    errors += !cal_node.packArray("short") + !cal_node.isPacked("short");
+    // a string spelling a packed header is refused, not taken for one
+    {
+        PropertyTree ft;
+        PropertyNode forged_node = PropertyNode(&ft, "/forged", true);
+        string forged("\0PKd\2\0\0\0", 8);
+        forged += string(16, 'A');
+        const char *forged_file = "/tmp/props_test_forged.json";
+        fp = fopen(forged_file, "w");
+        fprintf(fp, "{ \"s\": \"\\u0000PKd\\u0002\\u0000\\u0000\\u0000%s\" }\n",
+                forged.c_str() + 8);
+        fclose(fp);
+        errors += forged_node.load(forged_file);
+        unlink(forged_file);
+        errors += forged_node.setString("s", forged);
+        string forged_bin = string("\2\x08\1\2s\6\x18", 7) + forged;
+        errors += forged_node.readBinary(forged_bin.data(), forged_bin.length());
+        errors += forged_node.hasChild("s");
+        forged[3] = 'x';        // not a packed type, an ordinary string
+        errors += !forged_node.setString("s", forged);
+        errors += !forged_node.hasChild("s");
+    }
+    printf("packed array errors = %d\n", errors);
+
+    // numeric strings: repeated reads hit the conversion cache, which
+    // must follow string changes
+    PropertyNode str_node = PropertyNode("/config/strings", true);
+    str_node.setString("gain", "1.25");
+    errors = (str_node.getDouble("gain") != 1.25);
+    errors += (str_node.getDouble("gain") != 1.25);
+    str_node.setString("gain", "2.50");
+    errors += (str_node.getDouble("gain") != 2.5) + (str_node.getInt("gain") != 2);
+    str_node.setString("long", "123456789.1234567890123456789");
+    errors += (str_node.getInt("long") != 123456789);
+    str_node.setString("name", "not a number");
+    errors += (str_node.getDouble("name") != 0.0);
+    errors += str_node.getBool("yes");     // not a member yet
+    str_node.setString("yes", "True");
+    errors += !str_node.getBool("yes");
+    printf("numeric string errors = %d\n", errors);
+
+    // configs bigger than any single read buffer load completely
+    const char *big_file = "/tmp/props_test_big.json";
+    fp = fopen(big_file, "w");
+    fprintf(fp, "{");
+    for ( int i = 0; i < 500; i++ ) {
+        fprintf(fp, "%s\n  \"key%d\": { \"value\": %d }", i ? "," : "", i, i);
+    }
+    fprintf(fp, "\n}\n");
+    long big_size = ftell(fp);
+    fclose(fp);
+    PropertyNode big_node = PropertyNode("/config/big", true);
+    bool big_ok = big_node.load(big_file);
+    printf("big config (%ld bytes) loaded = %d key499 = %d\n", big_size,
+           big_ok, PropertyNode("/config/big/key499").getInt("value"));
+
+    // in situ load: strings point into the retained file buffer
+    const char *insitu_file = "/tmp/props_test_insitu.json";
+    fp = fopen(insitu_file, "w");
+    fprintf(fp, "{ \"port\": \"/dev/ttyS4\", \"baud\": 115200, "
+            "\"gps\": { \"model\": \"ublox m8n (long name)\" } }\n");
+    fclose(fp);
+    PropertyNode insitu_node = PropertyNode("/config/insitu", true);
+    errors = !insitu_node.load(insitu_file, PROPS2_LOAD_INSITU);
+    errors += insitu_node.getString("port") != "/dev/ttyS4";
+    errors += insitu_node.getInt("baud") != 115200;
+    errors += (PropertyNode("/config/insitu/gps").getString("model")
+               != "ublox m8n (long name)");
+    insitu_node.setString("port", "/dev/ttyS5 (a longer device name)");
+    errors += insitu_node.getString("port") != "/dev/ttyS5 (a longer device name)";
+    errors += insitu_node.load("/tmp", PROPS2_LOAD_INSITU);  // read fails
+    errors += insitu_node.load("/tmp");
+    printf("in situ load errors = %d\n", errors);
+
+    // include expansion: serial and parallel loads give the same tree
+    const int num_includes = 6;
+    for ( int i = 0; i < num_includes; i++ ) {
+        string inc_file = "/tmp/props_test_inc" + std::to_string(i) + ".json";
+        fp = fopen(inc_file.c_str(), "w");
+        fprintf(fp, "{ \"value\": %d, \"name\": \"include %d\" }\n", i, i);
+        fclose(fp);
+    }
+    const char *root_file = "/tmp/props_test_root.json";
+    fp = fopen(root_file, "w");
+    fprintf(fp, "{ \"top\": 1");
+    for ( int i = 0; i < num_includes; i++ ) {
+        fprintf(fp, ", \"dev%d\": { \"x\": %d, \"sub\": { \"include\": "
+                "\"/tmp/props_test_inc%d.json\" } }", i, i, i);
+    }
+    fprintf(fp, " }\n");
+    fclose(fp);
+    PropertyNode serial_node = PropertyNode("/config/inc_serial", true);
+    PropertyNode parallel_node = PropertyNode("/config/inc_parallel", true);
+    errors = !serial_node.load(root_file);
+    errors += !parallel_node.load(root_file, PROPS2_LOAD_PARALLEL_INCLUDES);
+    for ( int i = 0; i < num_includes; i++ ) {
+        string sub = "dev" + std::to_string(i) + "/sub";
+        PropertyNode s = serial_node.getChild(sub.c_str(), false);
+        PropertyNode p = parallel_node.getChild(sub.c_str(), false);
+        errors += (s.getInt("value") != i) + (p.getInt("value") != i);
+        errors += (s.getString("name") != p.getString("name"));
+        errors += s.hasChild("include") + p.hasChild("include");
+        errors += (s.getChildren() != p.getChildren());
+    }
+    printf("include errors = %d\n", errors);
+
+    // binary config cache: built on the first load, used while the
+    // config and its includes are unchanged, rebuilt when one changes
+    const char *cached_file = "/tmp/props_test_cached.json";
+    const char *cached_inc = "/tmp/props_test_cached_inc.json";
+    unlink("/tmp/props_test_cached.json.cache");
+    write_aged(cached_file, "{ \"rate\": 50, \"imu\": { \"include\": "
+               "\"/tmp/props_test_cached_inc.json\" } }", 20);
+    write_aged(cached_inc, "{ \"model\": \"mpu9250\", \"scale\": [ 1.5, 2.5, 3.5 ] }", 20);
+    errors = !PropertyNode("/config/cached1", true).load(cached_file, PROPS2_LOAD_USE_CACHE);
+    struct stat cache_st;
+    errors += (stat("/tmp/props_test_cached.json.cache", &cache_st) != 0);
+    errors += !PropertyNode("/config/cached2", true).load(cached_file, PROPS2_LOAD_USE_CACHE);
+    PropertyNode cached_imu = PropertyNode("/config/cached2/imu", false);
+    errors += (PropertyNode("/config/cached2").getInt("rate") != 50);
+    errors += (cached_imu.getString("model") != "mpu9250");
+    errors += (cached_imu.getDouble("scale", 2) != 3.5);
+    errors += cached_imu.hasChild("include");
+    write_aged(cached_inc, "{ \"model\": \"icm20948\" }", 10);
+    errors += !PropertyNode("/config/cached3", true).load(cached_file, PROPS2_LOAD_USE_CACHE);
+    errors += (PropertyNode("/config/cached3/imu").getString("model") != "icm20948");
+    printf("config cache errors = %d\n", errors);
+
+    // binary form round trips to the same json (every value type,
+    // packed arrays, nested arrays and objects)
+    PropertyNode types_node = PropertyNode("/config/types", true);
+    types_node.setBool("flag", true);
+    types_node.setInt("neg", -123456);
+    types_node.setUInt("big", 4000000000u);
+    types_node.setDouble("pi", 3.14159265358979);
+    types_node.setString("text", "tab\there \"quoted\"");
+    PropertyNode("/config/types/nested/2/deep", true).setInt("x", 1);
+    string bin;
+    errors = !PropertyNode("/config").writeBinary(bin);
+    PropertyNode rt_node = PropertyNode("/roundtrip/buffer", true);
+    errors += !rt_node.readBinary(bin.data(), bin.length());
+    errors += (json_text(rt_node) != json_text(PropertyNode("/config")));
+    errors += !PropertyNode("/config").saveBinary("/tmp/props_test.bin");
+    PropertyNode rt_file = PropertyNode("/roundtrip/file", true);
+    errors += !rt_file.loadBinary("/tmp/props_test.bin");
+    errors += (json_text(rt_file) != json_text(PropertyNode("/config")));
+    errors += rt_node.readBinary(bin.data(), bin.length() - 1); // truncated
+    bin[0] = bin[0] - 1;
+    errors += rt_node.readBinary(bin.data(), bin.length()); // old version
+    {
+        // nesting the decoder would refuse is refused when encoding
+        PropertyTree dt;
+        string deep = "/d";
+        for ( int i = 0; i < 60; i++ ) {
+            deep += "/d";
+        }
+        PropertyNode(&dt, deep, true).setInt("x", 1);
+        string deep_bin = "keep";
+        errors += !PropertyNode(&dt, "/").writeBinary(deep_bin);
+        errors += !PropertyNode(&dt, "/copy", true).readBinary(deep_bin.data() + 4,
+                                                               deep_bin.length() - 4);
+        deep += "/d/d/d/d/d";
+        PropertyNode(&dt, deep, true).setInt("x", 1);
+        deep_bin = "keep";
+        errors += PropertyNode(&dt, "/").writeBinary(deep_bin) + (deep_bin != "keep");
+    }
+    printf("binary round trip errors = %d (json %d bytes, binary %d bytes)\n",
+           errors, (int)json_text(PropertyNode("/config")).length(),
+           (int)bin.length());
+
+    // change tracking: only values set after a generation are reported
+    PropertyNode track_node = PropertyNode("/telemetry", true);
+    track_node.setDouble("alt", 100.0);
+    PropertyNode("/telemetry/gps", true).setInt("sats", 9);
+    PropertyNode("/telemetry/imu/1", true).setDouble("ax", 0.1);
+    PropertyLeaf<double> roll = PropertyNode("/telemetry/att", true).bindDouble("roll");
+    PropertyNode params_node = PropertyNode("/telemetry/params", true);
+    for ( int i = 0; i < 40; i++ ) {
+        params_node.setInt(("p" + std::to_string(i)).c_str(), i);
+    }
+    uint64_t frame = PropertyNode::getGeneration();
+    errors = track_node.changedSince(frame);
+    errors += !track_node.getChangedSince(frame).empty();
+    track_node.setDouble("alt", 101.0);
+    roll.set(0.5);
+    PropertyNode("/telemetry/imu/1").setDouble("ax", 0.2);
+    params_node.setInt("p37", -37);
+    vector<string> changes = track_node.getChangedSince(frame);
+    vector<string> expected = { "alt", "imu/1/ax", "att/roll", "params/p37" };
+    errors += (changes != expected);
+    errors += PropertyNode("/telemetry/gps").changedSince(frame);
+    errors += !PropertyNode("/telemetry/imu/1").changedSince(frame);
+    uint64_t frame2 = PropertyNode::getGeneration();
+    errors += !PropertyNode("/telemetry/gps").load(cached_inc);
+    changes = track_node.getChangedSince(frame2);
+    errors += (changes.size() != 1 or changes[0] != "gps");
+    errors += (PropertyNode("/telemetry/gps").getChangedSince(frame2)
+               != vector<string>(1, ""));
+    PropertyNode::setStableHandles(false);
+    PropertyNode raw_track = PropertyNode("/telemetry", true);
+    PropertyNode::setStableHandles(true);
+    errors += !raw_track.changedSince(PropertyNode::getGeneration());
+    {
+        // a load into a parent changes the children it replaces
+        PropertyTree lt;
+        PropertyNode config = PropertyNode(&lt, "/config", true);
+        PropertyNode gain = PropertyNode(&lt, "/config/gain", true);
+        PropertyNode other = PropertyNode(&lt, "/other", true);
+        uint64_t g = lt.getGeneration();
+        write_aged("/tmp/props_test_gain.json", "{ \"gain\": 2.5 }", 0);
+        errors += !config.load("/tmp/props_test_gain.json");
+        errors += !gain.changedSince(g) + other.changedSince(g);
+        errors += (gain.getChangedSince(g) != vector<string>(1, ""));
+        g = lt.getGeneration();
+        config.setDouble("gain", 3.0);
+        errors += !gain.changedSince(g);
+        unlink("/tmp/props_test_gain.json");
+    }
+    printf("change tracking errors = %d\n", errors);
+
+    // subscriptions: delivered once per dispatch(), only when changed
+    vector<string> delivered;
+    PropertyCallback record = [&delivered](const string &path) {
+        delivered.push_back(path);
+    };
+    int mode_sub = track_node.subscribe("mode", record);
+    track_node.subscribe("gps", record);
+    int once_sub = 0;
+    once_sub = track_node.subscribe("alt", [&](const string &path) {
+        delivered.push_back(path);
+        PropertyNode::unsubscribe(once_sub);
+    });
+    errors = (PropertyNode::dispatch() != 0);
+    track_node.setString("mode", "manual");
+    track_node.setString("mode", "auto");
+    track_node.setDouble("alt", 102.0);
+    PropertyNode("/telemetry/gps").setInt("sats", 10);
+    errors += (PropertyNode::dispatch() != 3);
+    expected = { "/telemetry/mode", "/telemetry/gps", "/telemetry/alt" };
+    errors += (delivered != expected);
+    errors += (PropertyNode::dispatch() != 0);
+    delivered.clear();
+    track_node.setDouble("alt", 103.0);
+    PropertyNode::unsubscribe(mode_sub);
+    track_node.setString("mode", "manual");
+    errors += (PropertyNode::dispatch() != 0) + !delivered.empty();
+    errors += (track_node.subscribe("mode", record) < 0);
+    PropertyNode::setStableHandles(false);
+    errors += (PropertyNode("/telemetry", true).subscribe("mode", record) != -1);
+    PropertyNode::setStableHandles(true);
+    {
+        // a leaf delivered by a load into its parent
+        PropertyTree lt;
+        PropertyNode config = PropertyNode(&lt, "/config", true);
+        int calls = 0;
+        config.subscribe("gain", [&calls](const string &) { calls++; });
+        lt.dispatch();
+        write_aged("/tmp/props_test_gain.json", "{ \"gain\": 2.5 }", 0);
+        errors += !config.load("/tmp/props_test_gain.json");
+        errors += (lt.dispatch() != 1) + (calls != 1) + (lt.dispatch() != 0);
+        unlink("/tmp/props_test_gain.json");
+    }
+    printf("subscription errors = %d\n", errors);
+
+    // concurrency mode: threads write their own nodes (in place, with
+    // occasional structural changes) while reading each other's
+    PropertyNode::setConcurrent(true);
+    const int stress_threads = 4;
+    const int stress_iterations = 20000;
+    std::atomic<int> stress_errors(0);
+    for ( int t = 0; t < stress_threads; t++ ) {
+        double zero[4] = { 0.0, 0.0, 0.0, 0.0 };
+        PropertyNode("/threads/dev" + std::to_string(t), true).setDoubleArray("v", zero, 4);
+    }
+    vector<std::thread> workers;
+    for ( int t = 0; t < stress_threads; t++ ) {
+        workers.push_back(std::thread([t, &stress_errors]() {
+            string mine_path = "/threads/dev" + std::to_string(t);
+            string other_path = "/threads/dev" + std::to_string((t + 1) % stress_threads);
+            PropertyNode mine = PropertyNode(mine_path, true);
+            PropertyNode other = PropertyNode(other_path, true);
+            PropertyLeaf<double> x = mine.bindDouble("x");
+            for ( int i = 0; i < stress_iterations; i++ ) {
+                double v[4] = { (double)i, (double)i, (double)i, (double)i };
+                mine.setInt("count", i);
+                mine.setDoubleArray("v", v, 4);
+                x.set(i * 0.5);
+                if ( mine.getInt("count") != i or x.get() != i * 0.5 ) {
+                    stress_errors++;
+                }
+                if ( other.getDoubleArray("v", v, 4) == 4
+                     and (v[1] != v[0] or v[2] != v[0] or v[3] != v[0]) ) {
+                    stress_errors++; // torn bulk write
+                }
+                other.getDouble("x");
+                other.getString("name");
+                if ( i % 1000 == 0 ) {
+                    mine.setString("name", "pass " + std::to_string(i / 1000));
+                    PropertyNode(mine_path + "/extra/" + std::to_string(i / 1000), true)
+                        .setInt("n", i);
+                }
+            }
+        }));
+    }
+    // meanwhile one thread keeps subscribing and unsubscribing while
+    // this one dispatches
+    std::atomic<bool> subscribing(true);
+    std::atomic<int> deliveries(0);
+    std::thread subscriber([&subscribing, &deliveries, &stress_errors]() {
+        PropertyNode threads = PropertyNode("/threads", true);
+        int last = -1;
+        for ( int i = 0; i < 2000; i++ ) {
+            string dev = "dev" + std::to_string(i % stress_threads);
+            int id = threads.subscribe(dev.c_str(), [&deliveries](const string &) {
+                deliveries++;
+            });
+            if ( id < 0 ) {
+                stress_errors++;
+            }
+            PropertyNode::unsubscribe(last);
+            last = id;
+        }
+        PropertyNode::unsubscribe(last);
+        subscribing = false;
+    });
+    while ( subscribing ) {
+        PropertyNode::dispatch();
+    }
+    subscriber.join();
+    for ( unsigned int t = 0; t < workers.size(); t++ ) {
+        workers[t].join();
+    }
+    PropertyNode::setConcurrent(false);
+    stress_errors += (PropertyNode::dispatch() != 0);
+    errors = stress_errors;
+    for ( int t = 0; t < stress_threads; t++ ) {
+        PropertyNode dev = PropertyNode("/threads/dev" + std::to_string(t));
+        errors += (dev.getInt("count") != stress_iterations - 1);
+        errors += (dev.getDouble("v", 3) != stress_iterations - 1);
+        errors += (dev.getChild("extra/19").getInt("n") != 19000);
+    }
+    printf("concurrency errors = %d\n", errors);
+
+    // snapshots: an immutable copy per publish, readable while the live
+    // tree changes (and pinned while held)
+    PropertyNode frame_node = PropertyNode("/frame", true);
+    frame_node.setInt("count", 1);
+    frame_node.setString("mode", "auto");
+    errors = !PropertySnapshot("/frame").isNull();
+    errors += !frame_node.publishSnapshot();
+    {
+        PropertySnapshot held("/frame/");
+        frame_node.setInt("count", 2);
+        errors += !frame_node.publishSnapshot();
+        PropertyNode old_frame = held.getNode();
+        errors += held.isNull() or (old_frame.getInt("count") != 1);
+        errors += (old_frame.getString("mode") != "auto");
+        errors += old_frame.setInt("count", 5); // read only
+        errors += !old_frame.getChild("missing/3", true).isNull();
+        errors += (PropertySnapshot("/frame").getNode().getInt("count") != 2);
+        errors += (PropertySnapshot("/frame").getGeneration() <= held.getGeneration());
+    }
+    errors += (frame_node.getInt("count") != 2);
+    frame_node.setInt("count", 3);
+    errors += (PropertySnapshot("/frame").getNode().getInt("count") != 2);
+
+    // a reader thread always sees whole frames while the controller
+    // keeps writing and publishing
+    const int frames = 2000;
+    std::atomic<bool> done(false);
+    std::atomic<int> torn(0);
+    std::thread reader([&done, &torn]() {
+        int last = -1;
+        while ( !done ) {
+            PropertySnapshot snap("/frame");
+            PropertyNode f = snap.getNode();
+            int count = f.getInt("count");
+            double v[8];
+            int n = f.getDoubleArray("v", v, 8);
+            for ( int i = 0; i < n; i++ ) {
+                torn += (v[i] != count);
+            }
+            torn += (count < last);
+            last = count;
+        }
+    });
+    for ( int i = 0; i < frames; i++ ) {
+        double v[8];
+        for ( int j = 0; j < 8; j++ ) {
+            v[j] = 3 + i;
+        }
+        frame_node.setDoubleArray("v", v, 8);
+        frame_node.setInt("count", 3 + i);
+        frame_node.publishSnapshot();
+    }
+    done = true;
+    reader.join();
+    errors += torn;
+    printf("snapshot errors = %d\n", errors);
+
+    // independent trees: same paths, separate values, generations,
+    // subscriptions and snapshots (and none of it in the default tree)
+    {
+        PropertyTree tree_a, tree_b;
+        PropertyNode sim_a = PropertyNode(&tree_a, "/sim/state", true);
+        PropertyNode sim_b = PropertyNode(&tree_b, "/sim/state", true);
+        int calls_a = 0;
+        sim_a.subscribe("alt", [&calls_a](const string &) { calls_a++; });
+        sim_a.setDouble("alt", 100.0);
+        sim_b.setDouble("alt", 200.0);
+        errors = (PropertyNode(&tree_a, "/sim/state").getDouble("alt") != 100.0);
+        errors += (sim_b.getDouble("alt") != 200.0);
+        errors += !PropertyNode("/sim", false).isNull();
+        errors += (tree_a.getGeneration() != 1) + (tree_b.getGeneration() != 1);
+        errors += (PropertyNode::dispatch() != 0) + (tree_b.dispatch() != 0);
+        errors += (tree_a.dispatch() != 1) + (calls_a != 1);
+        errors += !sim_b.publishSnapshot();
+        errors += !PropertySnapshot(&tree_a, "/sim/state").isNull();
+        errors += !PropertySnapshot("/sim/state").isNull();
+        errors += (PropertySnapshot(&tree_b, "/sim/state").getNode().getDouble("alt") != 200.0);
+
+        // settings are per tree too
+        tree_b.setStableHandles(false);
+        tree_b.setPackedArrays(0);
+        PropertyNode cal_a = PropertyNode(&tree_a, "/cal", true);
+        PropertyNode cal_b = PropertyNode(&tree_b, "/cal", true);
+        errors += !cal_a.load(cal_file) + !cal_b.load(cal_file);
+        errors += !cal_a.isPacked("table") + cal_b.isPacked("table");
+        errors += cal_a.changedSince(tree_a.getGeneration());
+        errors += !cal_b.changedSince(tree_b.getGeneration()); // raw
+        errors += PropertyNode("/config/cal").changedSince(PropertyNode::getGeneration());
+    }
+
+    // one tree per worker thread, no concurrency mode needed
+    const int tree_threads = 4;
+    std::atomic<int> tree_errors(0);
+    vector<std::thread> runs;
+    for ( int t = 0; t < tree_threads; t++ ) {
+        runs.push_back(std::thread([t, &tree_errors]() {
+            PropertyTree tree;
+            PropertyNode params = PropertyNode(&tree, "/params", true);
+            for ( int i = 0; i < 40; i++ ) {
+                params.setDouble(("p" + std::to_string(i)).c_str(), t + i);
+            }
+            PropertyNode state = PropertyNode(&tree, "/state", true);
+            PropertyLeaf<double> alt = state.bindDouble("alt");
+            uint64_t start = tree.getGeneration();
+            for ( int i = 0; i < 2000; i++ ) {
+                alt.set(alt.get() + params.getDouble("p39"));
+                if ( i % 100 == 0 ) {
+                    PropertyNode(&tree, "/log/" + std::to_string(i / 100), true)
+                        .setInt("step", i);
+                }
+            }
+            tree_errors += (alt.get() != 2000.0 * (t + 39));
+            tree_errors += (PropertyNode(&tree, "/log/19").getInt("step") != 1900);
+            tree_errors += (params.getChangedSince(start).size() != 0);
+            tree_errors += (state.getChangedSince(start).size() != 1);
+        }));
+    }
+    for ( unsigned int t = 0; t < runs.size(); t++ ) {
+        runs[t].join();
+    }
+    errors += tree_errors;
+    printf("tree errors = %d\n", errors);
+
+    // arena trees: allocate while initializing, then only in place
+    // stores succeed and everything else is refused
+    {
+        PropertyTree rt(256 * 1024);
+        PropertyNode rt_params = PropertyNode(&rt, "/params", true);
+        for ( int i = 0; i < 40; i++ ) {
+            rt_params.setDouble(("p" + std::to_string(i)).c_str(), i);
+        }
+        PropertyNode rt_state = PropertyNode(&rt, "/state", true);
+        double att[3] = { 0.0, 0.0, 0.0 };
+        rt_state.setDoubleArray("att", att, 3);
+        rt_state.setString("mode", "init");
+        PropertyLeaf<double> rt_alt = rt_state.bindDouble("alt");
+        rt.freezeAllocations();
+        uint64_t frozen_gen = rt.getGeneration();
+        PropertyArenaStats before = rt.getArenaStats();
+        errors = !before.frozen + (before.arena_size != 256 * 1024);
+        errors += (before.capacity > before.arena_size) + (before.high_water == 0);
+
+        att[1] = 2.0;
+        rt_alt.set(100.0);
+        errors += !rt_state.setDoubleArray("att", att, 3);
+        errors += !rt_state.setInt("alt", 7) + (rt_alt.get() != 7.0);
+        errors += !rt_state.setFloat("att", 2, 3.0);
+        errors += !rt_params.setDouble("p39", -1.0) + (rt_params.getDouble("p39") != -1.0);
+        errors += (rt_state.getDouble("att", 1) != 2.0);
+        // in place stores are still tracked, on records made at the freeze
+        errors += !PropertyNode(&rt, "/state").changedSince(frozen_gen);
+        errors += (rt_params.getChangedSince(frozen_gen) != vector<string>(1, "p39"));
+        errors += rt.getArenaStats().refused != 0;
+
+        errors += rt_state.setDouble("new", 1.0);
+        errors += rt_state.setString("mode", "automatic (too long to fit)");
+        errors += rt_state.setFloat("att", 5, 1.0);
+        errors += !PropertyNode(&rt, "/state/more/path").isNull();
+        errors += !rt_state.bindDouble("also_new").isNull();
+        errors += rt_state.readBinary("", 0);
+        PropertyArenaStats after = rt.getArenaStats();
+        errors += (after.high_water != before.high_water) + (after.refused != 6);
+        errors += (after.capacity != before.capacity);
+        errors += (rt_state.getString("mode") != "init") + rt_state.hasChild("new");
+        errors += !rt_state.setDoubleArray("att", att, 2); // shrinks in place
+
+        // an undersized arena spills onto the heap until frozen
+        PropertyTree small(1024);
+        for ( int i = 0; i < 100; i++ ) {
+            PropertyNode(&small, "/log/" + std::to_string(i), true).setInt("n", i);
+        }
+        small.freezeAllocations();
+        errors += (small.getArenaStats().capacity <= 1024);
+        errors += PropertyTree().getArenaStats().arena_size != 0;
+    }
+    printf("arena errors = %d\n", errors);
+
+    // memory accounting: regrown arrays (and replaced values) are
+    // leaked into the pool until compact() rebuilds the tree
+    {
+        PropertyTree gs;
+        PropertyNode gs_params = PropertyNode(&gs, "/params", true);
+        for ( int i = 0; i < 40; i++ ) {
+            gs_params.setDouble(("p" + std::to_string(i)).c_str(), i);
+        }
+        PropertyNode gs_link = PropertyNode(&gs, "/link", true);
+        PropertyLeaf<double> gs_rssi = gs_link.bindDouble("rssi");
+        vector<double> hist;
+        for ( int i = 0; i < 500; i++ ) {
+            gs_link.setString("status", "connected, packet " + std::to_string(i));
+            hist.push_back(i);
+            gs_link.setDoubleArray("hist", hist.data(), hist.size());
+            gs_link.setDoubleArray("hist2", hist.data(), hist.size());
+        }
+        PropertyMemoryStats before = gs.getMemoryStats();
+        PropertyMemoryStats link_before = gs_link.getMemoryStats();
+        errors = (before.allocator_bytes < 4 * before.live_bytes);
+        errors += (link_before.live_bytes >= before.live_bytes);
+        errors += (link_before.allocator_bytes != before.allocator_bytes);
+
+        errors += !gs.compact();
+        PropertyMemoryStats after = gs.getMemoryStats();
+        errors += (after.values != before.values);
+        errors += (after.allocator_bytes >= before.allocator_bytes / 4);
+        errors += (after.allocator_bytes > after.live_bytes + after.live_bytes / 10);
+        errors += (gs_link.getString("status") != "connected, packet 499");
+        errors += (gs_link.getDouble("hist", 499) != 499.0);
+        errors += (gs_params.getDouble("p39") != 39.0);
+        gs_rssi.set(-40.0);
+        errors += (PropertyNode(&gs, "/link").getDouble("rssi") != -40.0);
+        errors += !gs_params.setDouble("p40", 40.0);
+
+        // arena trees compact back into their arena
+        PropertyTree rt(64 * 1024);
+        PropertyNode rt_link = PropertyNode(&rt, "/link", true);
+        for ( int i = 0; i < 200; i++ ) {
+            rt_link.setString("status", "connected, packet " + std::to_string(i));
+        }
+        size_t used = rt.getArenaStats().high_water;
+        errors += !rt.compact();
+        PropertyArenaStats rt_after = rt.getArenaStats();
+        errors += (rt_after.high_water >= used / 4);
+        errors += (rt_after.capacity > rt_after.arena_size);
+        errors += (rt_link.getString("status") != "connected, packet 199");
+        rt.freezeAllocations();
+        errors += rt.compact();
+    }
+    printf("memory errors = %d\n", errors);
+
+    // string leaves: rewritten in place once they have a buffer
+    {
+        PropertyTree st;
+        PropertyNode st_link = PropertyNode(&st, "/link", true);
+        st_link.setString("status", "connected, packet 0");
+        st_link.setString("mode", "init");
+        size_t used = st.getDocument().GetAllocator().Size();
+        char status[64];
+        for ( int i = 0; i < 1000; i++ ) {
+            snprintf(status, sizeof(status), "connected, packet %d", i);
+            st_link.setString("status", status);
+            st_link.setString("mode", i % 2 ? "auto" : "manual");
+        }
+        st_link.setString("status", "lost");
+        st_link.setString("status", string("lost, retry 12"));
+        errors = (st.getDocument().GetAllocator().Size() != used);
+        errors += (st_link.getString("status") != "lost, retry 12");
+        errors += (st_link.getString("mode") != "auto");
+
+        // a snapshot keeps its own copy of a buffered string
+        st_link.setString("status", "connected, packet 1000");
+        st_link.publishSnapshot();
+        st_link.setString("status", "connected, packet 1001");
+        PropertySnapshot st_snap(&st, "/link");
+        errors += (st_snap.getNode().getString("status") != "connected, packet 1000");
+
+        // outgrowing the buffer allocates a bigger one, frozen trees can
+        // still rewrite in place
+        st_link.setString("status", "reconnecting after a long link outage");
+        errors += (st_link.getString("status") != "reconnecting after a long link outage");
+        st.freezeAllocations();
+        errors += !st_link.setString("status", "connected, packet 1002");
+        errors += !st_link.setString("mode", "manual");
+        errors += (st_link.getString("status") != "connected, packet 1002");
+        errors += (st.getArenaStats().refused != 0);
+    }
+    printf("string errors = %d\n", errors);
+
+    // save() round trips through load() in both formats
+    {
+        PropertyTree sv;
+        PropertyNode sv_node = PropertyNode(&sv, "/flight", true);
+        sv_node.setString("mode", "auto \"quoted\"");
+        sv_node.setInt("count", 42);
+        double hist[8];
+        for ( int i = 0; i < 8; i++ ) {
+            hist[i] = i * 0.5;
+        }
+        sv_node.setDoubleArray("hist", hist, 8);
+        sv_node.packArray("hist");
+        for ( int i = 0; i < 3; i++ ) {
+            PropertyNode(&sv, "/flight/log/" + std::to_string(i), true)
+                .setDouble("t", i * 0.25);
+        }
+        const char *paths[2] = { "/tmp/props_test_save_compact.json",
+                                 "/tmp/props_test_save_pretty.json" };
+        int formats[2] = { PROPS2_SAVE_COMPACT, PROPS2_SAVE_PRETTY };
+        errors = 0;
+        for ( int i = 0; i < 2; i++ ) {
+            errors += !sv_node.save(paths[i], formats[i]);
+            PropertyTree back;
+            PropertyNode back_node = PropertyNode(&back, "/flight", true);
+            errors += !back_node.load(paths[i]);
+            errors += (back_node.getString("mode") != "auto \"quoted\"");
+            errors += (back_node.getInt("count") != 42);
+            errors += (back_node.getLen("hist") != 8);
+            errors += (back_node.getDouble("hist", 7) != 3.5);
+            errors += (PropertyNode(&back, "/flight/log/2").getDouble("t") != 0.5);
+            errors += (access((string(paths[i]) + ".tmp").c_str(), F_OK) == 0);
+            unlink(paths[i]);
+        }
+        errors += sv_node.save("/nonexistent/dir/props_test_save.json");
+    }
+    printf("save errors = %d\n", errors);
+
+    // wildcard queries bind leaf sets for bulk reads and writes
+    {
+        PropertyTree qt;
+        for ( int i = 0; i < 4; i++ ) {
+            PropertyNode imu = PropertyNode(&qt, "/sensors/imu/" + std::to_string(i), true);
+            imu.setDouble("az", -9.8 - i);
+            imu.setDouble("ax", i);
+        }
+        PropertyNode(&qt, "/actuators", true).setDouble("cmd", 0.5);
+        PropertyNode(&qt, "/actuators/left/servo", true).setDouble("cmd", 1.0);
+        PropertyNode(&qt, "/actuators/right", true).setInt("cmd", 2);
+        PropertyNode(&qt, "/actuators/right", true).setString("name", "aileron");
+
+        PropertyNode root = PropertyNode(&qt, "/", true);
+        PropertyQuery az = root.query("/sensors/imu/*/az");
+        double buf[8];
+        errors = (az.size() != 4) + (az.getPath(3) != "sensors/imu/3/az");
+        errors += (az.getDoubles(buf, 8) != 4) + (buf[2] != -11.8);
+        PropertyQuery cmd = PropertyNode(&qt, "/actuators").query("**/cmd");
+        errors += (cmd.size() != 3) + (cmd.getPath(0) != "cmd");
+        errors += (cmd.getPath(2) != "right/cmd");
+        double cmds[3] = { 0.25, 0.75, 1.25 };
+        errors += (cmd.setDoubles(cmds, 3) != 3);
+        errors += (PropertyNode(&qt, "/actuators/left/servo").getDouble("cmd") != 0.75);
+        errors += (PropertyNode(&qt, "/actuators/right").getString("cmd") != "1");
+        PropertyNode(&qt, "/sensors/imu/1", true).setString("name", "aux");
+        PropertyNode(&qt, "/sensors/imu/1", true).setBool("ok", true);
+        errors += (root.query("/sensors/imu/1/*").size() != 2);
+        errors += (PropertyNode(&qt, "/actuators").query("*/*").size() != 1);
+        errors += (root.query("/sensors/**").size() != 0);
+        errors += (root.query("/nothing/*/here").size() != 0);
+
+        // handles survive tree growth, refresh() picks up new devices
+        PropertyNode(&qt, "/sensors/imu/4", true).setDouble("az", -20.0);
+        float fbuf[8];
+        errors += (az.getFloats(fbuf, 8) != 4) + (fbuf[3] != -12.8f);
+        errors += !az.refresh() + (az.size() != 5);
+        errors += (az.getDoubles(buf, 8) != 5) + (buf[4] != -20.0);
+
+        // members with numeric names are matched (and bound) by name,
+        // the query leaves the tree as it found it
+        const char *servo_file = "/tmp/props_test_servos.json";
+        FILE *sfp = fopen(servo_file, "w");
+        fprintf(sfp, "{ \"1\": { \"cmd\": 0.5 }, \"name\": \"x\" }\n");
+        fclose(sfp);
+        PropertyNode servos = PropertyNode(&qt, "/servos", true);
+        errors += !servos.load(servo_file);
+        unlink(servo_file);
+        string servos_text = json_text(servos);
+        PropertyQuery servo_cmd = root.query("/servos/*/cmd");
+        errors += (servo_cmd.size() != 1) + (servo_cmd.getPath(0) != "servos/1/cmd");
+        errors += (servo_cmd.getDoubles(buf, 8) != 1) + (buf[0] != 0.5);
+        errors += (json_text(servos) != servos_text);
+        buf[0] = 0.25;
+        servo_cmd.setDoubles(buf, 1);
+        errors += (servos.getString("name") != "x");
+        errors += (PropertyNode(&qt, "/servos").getChildren(false).size() != 2);
+    }
+    printf("query errors = %d\n", errors);
+
+    // visiting children yields names, indices and nodes in place
+    {
+        PropertyTree vt;
+        PropertyNode vt_node = PropertyNode(&vt, "/log", true);
+        vt_node.setDouble("alt", 100.0);
+        vt_node.setString("mode", "auto");
+        double att[3] = { 1.0, 2.0, 3.0 };
+        vt_node.setDoubleArray("att", att, 3);
+        vt_node.setDoubleArray("packed", att, 3);
+        vt_node.packArray("packed");
+        PropertyNode(&vt, "/log/gps", true).setInt("sats", 9);
+
+        string names;
+        double sum = 0.0;
+        int leaves = 0;
+        int count = vt_node.visitChildren([&](PropertyChild &child) {
+            names += string(child.name, child.name_len);
+            names += (child.index >= 0) ? std::to_string(child.index) : "";
+            names += ",";
+            if ( child.leaf ) {
+                leaves++;
+                sum += getValueAsDouble(*child.node.get_valptr());
+            } else {
+                sum += child.node.getInt("sats");
+            }
+            return true;
+        });
+        errors = (count != 9) + (leaves != 8) + (sum != 121.0);
+        errors += (names != "alt,mode,att0,att1,att2,packed0,packed1,packed2,gps,");
+        errors += (vt_node.visitChildren([](PropertyChild &) { return true; }, false) != 5);
+
+        // set through child nodes, stop early
+        count = vt_node.visitChildren([](PropertyChild &child) {
+            if ( !child.leaf ) {
+                child.node.setInt("sats", 12);
+                return false;
+            }
+            return true;
+        });
+        errors += (count != 9) + (PropertyNode(&vt, "/log/gps").getInt("sats") != 12);
+        count = vt_node.visitChildren([](PropertyChild &child) {
+            return child.index < 0;
+        });
+        errors += (count != 3);
+    }
+    printf("visit errors = %d\n", errors);
+
     PropertyNode("/").pretty_print();
 }